@@ -0,0 +1,262 @@
+#include "devices/block.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+
+/* A block device. */
+struct block
+  {
+    char name[16];                      /* Name, e.g. "hd0:1". */
+    disk_sector_t size;                 /* Size in sectors. */
+    const struct block_operations *ops; /* Driver operations. */
+    void *aux;                          /* Passed to the operations. */
+
+    long long read_cnt;                 /* Number of sectors read. */
+    long long write_cnt;                /* Number of sectors written. */
+  };
+
+/* All registered block devices, in registration order. */
+#define MAX_BLOCKS 8
+static struct block *blocks[MAX_BLOCKS];
+static size_t block_cnt;
+
+/* The device playing each role, or a null pointer. */
+static struct block *block_by_role[BLOCK_ROLE_CNT];
+
+/* Contiguous transfers are passed to drivers in pieces of this
+   many sectors, each described by an array on the stack. */
+#define CHUNK_SECTORS 64
+
+static void check_sectors (const struct block *, disk_sector_t, size_t cnt);
+static void transfer (struct block *, disk_sector_t, size_t cnt,
+                      uint8_t *buffer, void *const bufs[], bool write);
+
+/* Registers a new block device named NAME, of SIZE sectors,
+   whose driver provides OPS and wants AUX passed to them.
+   Returns the new device; panics if memory or slots run out. */
+struct block *
+block_register (const char *name, disk_sector_t size,
+                const struct block_operations *ops, void *aux)
+{
+  struct block *b = malloc (sizeof *b);
+
+  if (b == NULL || block_cnt >= MAX_BLOCKS)
+    PANIC ("failed to register block device %s", name);
+  ASSERT (ops->read != NULL && ops->write != NULL);
+
+  strlcpy (b->name, name, sizeof b->name);
+  b->size = size;
+  b->ops = ops;
+  b->aux = aux;
+  b->read_cnt = b->write_cnt = 0;
+  blocks[block_cnt++] = b;
+  return b;
+}
+
+/* Returns the block device named NAME, or a null pointer if
+   there is none. */
+struct block *
+block_get_by_name (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < block_cnt; i++)
+    if (!strcmp (blocks[i]->name, name))
+      return blocks[i];
+  return NULL;
+}
+
+/* Returns the block device playing ROLE, or a null pointer if
+   none does. */
+struct block *
+block_get_role (enum block_role role)
+{
+  ASSERT (role < BLOCK_ROLE_CNT);
+  return block_by_role[role];
+}
+
+/* Makes B play ROLE, which B may be null to leave unplayed. */
+void
+block_set_role (enum block_role role, struct block *b)
+{
+  ASSERT (role < BLOCK_ROLE_CNT);
+  block_by_role[role] = b;
+}
+
+/* Returns a human-readable name for ROLE. */
+const char *
+block_role_name (enum block_role role)
+{
+  static const char *names[BLOCK_ROLE_CNT] = {"filesys", "scratch", "swap"};
+
+  ASSERT (role < BLOCK_ROLE_CNT);
+  return names[role];
+}
+
+/* Returns B's name, e.g. "hd0:1". */
+const char *
+block_name (const struct block *b)
+{
+  return b->name;
+}
+
+/* Returns the size of B in sectors. */
+disk_sector_t
+block_size (const struct block *b)
+{
+  return b->size;
+}
+
+/* Reads sector SECTOR from B into BUFFER, which must have room
+   for DISK_SECTOR_SIZE bytes.  Drivers synchronize accesses to
+   their devices, so external per-device locking is unneeded. */
+void
+block_read (struct block *b, disk_sector_t sector, void *buffer)
+{
+  block_read_vector (b, sector, 1, &buffer);
+}
+
+/* Writes sector SECTOR of B from BUFFER, which must contain
+   DISK_SECTOR_SIZE bytes.  Returns after the device has
+   acknowledged receiving the data. */
+void
+block_write (struct block *b, disk_sector_t sector, const void *buffer)
+{
+  block_write_vector (b, sector, 1, &buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from B into BUFFER, which
+   must have room for CNT * DISK_SECTOR_SIZE bytes. */
+void
+block_read_multiple (struct block *b, disk_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  transfer (b, sector, cnt, buffer, NULL, false);
+}
+
+/* Writes CNT sectors starting at SECTOR of B from BUFFER, which
+   must contain CNT * DISK_SECTOR_SIZE bytes. */
+void
+block_write_multiple (struct block *b, disk_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  transfer (b, sector, cnt, (uint8_t *) buffer, NULL, true);
+}
+
+/* Reads CNT sectors starting at SECTOR from B, sector I into
+   BUFS[I], which must have room for DISK_SECTOR_SIZE bytes. */
+void
+block_read_vector (struct block *b, disk_sector_t sector, size_t cnt,
+                   void *const bufs[])
+{
+  transfer (b, sector, cnt, NULL, bufs, false);
+}
+
+/* Writes CNT sectors starting at SECTOR of B, sector I from
+   BUFS[I], which must contain DISK_SECTOR_SIZE bytes. */
+void
+block_write_vector (struct block *b, disk_sector_t sector, size_t cnt,
+                    const void *const bufs[])
+{
+  transfer (b, sector, cnt, NULL, (void *const *) bufs, true);
+}
+
+/* Queues request R for its device, which calls R->done once the
+   transfer is complete.  A device whose driver has no queue does
+   the transfer, and calls R->done, before returning. */
+void
+block_submit (struct block_request *r)
+{
+  struct block *b = r->block;
+
+  ASSERT (r->done != NULL);
+  ASSERT (r->buffer != NULL || r->bufs != NULL);
+  check_sectors (b, r->sector, r->cnt);
+
+  if (b->ops->submit != NULL)
+    {
+      if (r->write)
+        b->write_cnt += r->cnt;
+      else
+        b->read_cnt += r->cnt;
+      b->ops->submit (b->aux, r);
+    }
+  else
+    {
+      transfer (b, r->sector, r->cnt, r->buffer, (void *const *) r->bufs,
+                r->write);
+      r->done (r);
+    }
+}
+
+/* Makes the writes to B completed so far durable. */
+void
+block_flush (struct block *b)
+{
+  if (b->ops->flush != NULL)
+    b->ops->flush (b->aux);
+}
+
+/* Prints statistics for each block device. */
+void
+block_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < block_cnt; i++)
+    printf ("%s: %lld reads, %lld writes\n",
+            blocks[i]->name, blocks[i]->read_cnt, blocks[i]->write_cnt);
+}
+
+/* Panics unless CNT sectors starting at SECTOR lie within B. */
+static void
+check_sectors (const struct block *b, disk_sector_t sector, size_t cnt)
+{
+  ASSERT (b != NULL);
+  if (cnt > b->size || sector > b->size - cnt)
+    PANIC ("%s: access past end of device, sector=%"PRDSNu", count=%zu",
+           b->name, sector, cnt);
+}
+
+/* Transfers CNT sectors starting at SECTOR between B and memory
+   through B's read or write operation, writing to B if WRITE and
+   reading otherwise.  Sector I goes to or from BUFS[I] if BUFS is
+   nonnull, or else from offset I * DISK_SECTOR_SIZE in BUFFER. */
+static void
+transfer (struct block *b, disk_sector_t sector, size_t cnt,
+          uint8_t *buffer, void *const bufs[], bool write)
+{
+  check_sectors (b, sector, cnt);
+  if (write)
+    b->write_cnt += cnt;
+  else
+    b->read_cnt += cnt;
+
+  while (cnt > 0)
+    {
+      void *chunk[CHUNK_SECTORS];
+      void *const *v = bufs;
+      size_t n = cnt;
+      size_t i;
+
+      if (bufs == NULL)
+        {
+          if (n > CHUNK_SECTORS)
+            n = CHUNK_SECTORS;
+          for (i = 0; i < n; i++)
+            chunk[i] = buffer + i * DISK_SECTOR_SIZE;
+          v = chunk;
+          buffer += n * DISK_SECTOR_SIZE;
+        }
+      else
+        bufs += n;
+
+      if (write)
+        b->ops->write (b->aux, sector, n, (const void *const *) v);
+      else
+        b->ops->read (b->aux, sector, n, v);
+      sector += n;
+      cnt -= n;
+    }
+}
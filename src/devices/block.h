@@ -0,0 +1,110 @@
+#ifndef DEVICES_BLOCK_H
+#define DEVICES_BLOCK_H
+
+#include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Size of a disk sector in bytes. */
+#define DISK_SECTOR_SIZE 512
+
+/* Index of a disk sector within a disk.
+   Good enough for disks up to 2 TB. */
+typedef uint32_t disk_sector_t;
+
+/* Format specifier for printf(), e.g.:
+   printf ("sector=%"PRDSNu"\n", sector); */
+#define PRDSNu PRIu32
+
+/* A block device: anything that stores DISK_SECTOR_SIZE-byte
+   sectors, such as an ATA disk or a RAM disk.  The file system
+   and swap find theirs by role. */
+struct block;
+
+/* What the kernel uses a block device for. */
+enum block_role
+  {
+    BLOCK_FILESYS,              /* File system. */
+    BLOCK_SCRATCH,              /* Scratch disk for put and get. */
+    BLOCK_SWAP,                 /* Swap. */
+    BLOCK_ROLE_CNT
+  };
+
+struct block_request;
+
+/* Called when the transfer of a request is complete.  It may be
+   called from a driver's I/O thread, or before block_submit()
+   returns, and may not wait for block I/O itself. */
+typedef void block_done_func (struct block_request *);
+
+/* An asynchronous transfer.  The submitter fills in the members
+   up to AUX, passes the request to block_submit(), and leaves it
+   alone until DONE is called.  Drivers may reorder requests, so
+   requests for overlapping sectors may complete in any order. */
+struct block_request
+  {
+    struct block *block;
+    disk_sector_t sector;       /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    bool write;                 /* Write to the device, or read? */
+    uint8_t *buffer;            /* CNT sectors of memory, if BUFS is null. */
+    void *const *bufs;          /* Otherwise, sector I's memory in BUFS[I]. */
+    block_done_func *done;      /* Called on completion. */
+    void *aux;                  /* For use by DONE. */
+
+    /* Owned by the driver. */
+    void *dev;                  /* Driver's device. */
+    size_t started;             /* Sectors handed to the device so far. */
+    int64_t deadline;           /* Tick by which it should start. */
+    struct list_elem sort_elem; /* Element in the driver's sorted queue. */
+    struct list_elem fifo_elem; /* Element in the driver's FIFO. */
+  };
+
+/* What a block device driver provides.  AUX is the pointer the
+   driver registered the device with.  Sector numbers are checked
+   against the device's size before a call. */
+struct block_operations
+  {
+    /* Read or write CNT sectors starting at SECTOR, sector I at
+       BUFS[I], and return when done. */
+    void (*read) (void *aux, disk_sector_t sector, size_t cnt,
+                  void *const bufs[]);
+    void (*write) (void *aux, disk_sector_t sector, size_t cnt,
+                   const void *const bufs[]);
+
+    /* Queues R and returns, calling R->done once it is complete.
+       Null if the driver has no queue: read and write are used. */
+    void (*submit) (void *aux, struct block_request *r);
+
+    /* Makes the writes completed so far durable.  Null if they
+       already are. */
+    void (*flush) (void *aux);
+  };
+
+struct block *block_register (const char *name, disk_sector_t size,
+                              const struct block_operations *, void *aux);
+struct block *block_get_by_name (const char *name);
+struct block *block_get_role (enum block_role);
+void block_set_role (enum block_role, struct block *);
+const char *block_role_name (enum block_role);
+
+const char *block_name (const struct block *);
+disk_sector_t block_size (const struct block *);
+
+void block_read (struct block *, disk_sector_t, void *);
+void block_write (struct block *, disk_sector_t, const void *);
+void block_read_multiple (struct block *, disk_sector_t, size_t cnt, void *);
+void block_write_multiple (struct block *, disk_sector_t, size_t cnt,
+                           const void *);
+void block_read_vector (struct block *, disk_sector_t, size_t cnt,
+                        void *const bufs[]);
+void block_write_vector (struct block *, disk_sector_t, size_t cnt,
+                         const void *const bufs[]);
+void block_submit (struct block_request *);
+void block_flush (struct block *);
+
+void block_print_stats (void);
+
+#endif /* devices/block.h */
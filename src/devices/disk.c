@@ -7,9 +7,14 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  Transfers go
+   by bus-master DMA, as on the PIIX controllers, where the
+   controller and disk support it, and by PIO otherwise. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -28,10 +33,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus-master IDE register port addresses, for controllers that
+   can do DMA.  Each channel has its own 8-byte block of them. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)   /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)    /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)      /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_START 0x01           /* Start the transfer. */
+#define BM_READ 0x08            /* Transfer into memory. */
+
+/* Bus-master Status Register bits, cleared by writing 1. */
+#define BM_ERR 0x02             /* Transfer failed. */
+#define BM_INTR 0x04            /* Disk interrupted. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +67,43 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+#define CMD_FLUSH_CACHE 0xe7            /* FLUSH CACHE. */
+
+/* Most sectors one command can transfer: a sector count of 0
+   means 256. */
+#define MAX_XFER_SECTORS 256
+
+/* Most sectors per interrupt we ask for with SET MULTIPLE MODE. */
+#define MAX_MULTIPLE 16
+
+/* A physical region descriptor, one entry in the table that tells
+   the bus master where in memory a DMA transfer goes.  A region
+   may not cross a 64 kB boundary; a size of 0 means 64 kB. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+#define PRD_EOT 0x8000
+#define PRD_BOUNDARY 0x10000
+
+/* Entries in one page of PRD table, enough for a transfer of
+   MAX_XFER_SECTORS scattered sectors each split at a boundary. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* Requests are served in C-LOOK order, ascending by sector and
+   wrapping around to the lowest, unless the oldest read or write
+   has waited past its deadline, READ_EXPIRE or WRITE_EXPIRE ticks
+   after it was submitted.  Reads get the shorter deadline since
+   someone is usually waiting on them. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (5 * TIMER_FREQ)
 
 /* An ATA device. */
 struct disk 
@@ -57,9 +114,10 @@ struct disk
 
     bool is_ata;                /* 1=This device is an ATA disk. */
     disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
-
-    long long read_cnt;         /* Number of sectors read. */
-    long long write_cnt;        /* Number of sectors written. */
+    size_t multiple;            /* Sectors per interrupt, 1 if READ
+                                   and WRITE MULTIPLE are not in use. */
+    bool dma;                   /* Transfer by DMA? */
+    bool flush;                 /* Has a write cache to flush? */
   };
 
 /* An ATA channel (aka controller).
@@ -69,12 +127,23 @@ struct channel
     char name[8];               /* Name, e.g. "hd0". */
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
+    uint16_t bm_base;           /* Bus-master base I/O port, 0 if none. */
+    struct prd *prdt;           /* PRD table, one page, if bm_base. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    /* Once the disks are identified, only the channel's I/O thread
+       touches the controller, serving requests from the queue. */
+    struct lock lock;           /* Guards the queue and head position. */
+    struct condition queued;    /* Signaled when a request arrives. */
+    struct list sorted;         /* Requests by device, then sector. */
+    struct list fifo[2];        /* Reads, writes, oldest first. */
+    int head_dev;               /* Device and sector just past the */
+    disk_sector_t head;         /* end of the last command. */
+    void *bufs[MAX_XFER_SECTORS]; /* Memory of the command in progress. */
+
     struct disk devices[2];     /* The devices on this channel. */
   };
 
@@ -86,8 +155,27 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void set_multiple_mode (struct disk *, int max);
+static const struct block_operations ata_operations;
+static void queue_request (struct disk *, struct block_request *);
+static void transfer (struct disk *, disk_sector_t, size_t cnt,
+                      void *const bufs[], bool write);
+static void io_thread (void *channel);
+static struct block_request *next_request (struct channel *);
+static size_t take_sectors (struct channel *, struct block_request *,
+                            size_t n);
+static bool request_less (const struct list_elem *,
+                          const struct list_elem *, void *);
+static void pio_command (struct disk *, disk_sector_t, size_t cnt,
+                         void *const bufs[], bool write);
+static bool dma_command (struct disk *, disk_sector_t, size_t cnt,
+                         void *const bufs[], bool write);
+static bool fill_prdt (struct channel *, size_t cnt, void *const bufs[]);
+static void flush_command (struct disk *);
+static uint16_t find_bus_master (void);
+
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -98,10 +186,12 @@ static void select_device_wait (const struct disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
-/* Initialize the disk subsystem and detect disks. */
+/* Initializes the disk subsystem, detects disks, and registers
+   each as a block device. */
 void
 disk_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -124,9 +214,23 @@ disk_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      lock_init (&c->lock);
+      cond_init (&c->queued);
+      list_init (&c->sorted);
+      list_init (&c->fifo[0]);
+      list_init (&c->fifo[1]);
+      c->head_dev = 0;
+      c->head = 0;
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + 8 * chan_no;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -138,8 +242,9 @@ disk_init (void)
 
           d->is_ata = false;
           d->capacity = 0;
-
-          d->read_cnt = d->write_cnt = 0;
+          d->multiple = 1;
+          d->dma = false;
+          d->flush = false;
         }
 
       /* Register interrupt handler. */
@@ -156,111 +261,407 @@ disk_init (void)
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
+
+      /* Hand the channel over to its I/O thread. */
+      if (c->devices[0].is_ata || c->devices[1].is_ata)
+        thread_create (c->name, PRI_MAX, io_thread, c);
     }
 }
 
-/* Prints disk statistics. */
-void
-disk_print_stats (void) 
+/* Block device operations for an ATA disk, whose AUX is the
+   struct disk. */
+
+static void
+ata_read (void *d, disk_sector_t sec_no, size_t cnt, void *const bufs[]) 
 {
-  int chan_no;
+  transfer (d, sec_no, cnt, bufs, false);
+}
+
+static void
+ata_write (void *d, disk_sector_t sec_no, size_t cnt,
+           const void *const bufs[]) 
+{
+  transfer (d, sec_no, cnt, (void *const *) bufs, true);
+}
+
+static void
+ata_submit (void *d, struct block_request *r) 
+{
+  queue_request (d, r);
+}
 
-  for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) 
+/* A write of no sectors makes the I/O thread flush the disk's
+   write cache.  It is queued only in the FIFO of writes, and
+   served once it reaches the front, so every write queued before
+   it has been handed to the disk by then. */
+static void
+ata_flush (void *d_) 
+{
+  struct disk *d = d_;
+
+  if (d->flush)
+    transfer (d, 0, 0, NULL, true);
+}
+
+static const struct block_operations ata_operations =
+  {
+    ata_read,
+    ata_write,
+    ata_submit,
+    ata_flush,
+  };
+
+/* Queues request R for disk D.  R->done is called once the
+   transfer is complete; the caller goes on meanwhile. */
+static void
+queue_request (struct disk *d, struct block_request *r) 
+{
+  struct channel *c = d->channel;
+
+  ASSERT (r->done != NULL);
+  ASSERT (r->cnt == 0 ? r->write : r->buffer != NULL || r->bufs != NULL);
+
+  r->dev = d;
+  r->started = 0;
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  lock_acquire (&c->lock);
+  if (r->cnt > 0)
+    list_insert_ordered (&c->sorted, &r->sort_elem, request_less, NULL);
+  list_push_back (&c->fifo[r->write], &r->fifo_elem);
+  cond_signal (&c->queued, &c->lock);
+  lock_release (&c->lock);
+}
+
+/* Wakes up the thread waiting in transfer() for request R. */
+static void
+wake_up (struct block_request *r) 
+{
+  sema_up (r->aux);
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFS, sector I in BUFS[I], writing to the disk if WRITE and
+   reading otherwise, and returns when it is done. */
+static void
+transfer (struct disk *d, disk_sector_t sec_no, size_t cnt,
+          void *const bufs[], bool write)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  r.sector = sec_no;
+  r.cnt = cnt;
+  r.write = write;
+  r.buffer = NULL;
+  r.bufs = bufs;
+  r.done = wake_up;
+  r.aux = &done;
+  queue_request (d, &r);
+  sema_down (&done);
+}
+
+/* A channel's I/O thread.  Takes the next request off the queue,
+   along with the requests that directly follow it on the disk,
+   and transfers them with a single command, then reports the
+   ones that are complete. */
+static void
+io_thread (void *channel) 
+{
+  struct channel *c = channel;
+
+  for (;;)
     {
-      int dev_no;
+      struct list done;
+      struct block_request *r;
+      struct disk *d;
+      disk_sector_t sec_no;
+      bool write;
+      size_t n;
+
+      list_init (&done);
+      lock_acquire (&c->lock);
+      while (list_empty (&c->sorted) && list_empty (&c->fifo[1]))
+        cond_wait (&c->queued, &c->lock);
+      r = next_request (c);
+      d = r->dev;
+      if (r->cnt == 0)
+        {
+          list_remove (&r->fifo_elem);
+          lock_release (&c->lock);
+          flush_command (d);
+          r->done (r);
+          continue;
+        }
+      sec_no = r->sector + r->started;
+      write = r->write;
+      n = take_sectors (c, r, 0);
+      for (;;)
+        {
+          struct list_elem *e = list_next (&r->sort_elem);
+          struct block_request *next;
+
+          /* A request that does not fit in the command stays in
+             place, to go on from where this one ends. */
+          list_remove (&r->fifo_elem);
+          list_remove (&r->sort_elem);
+          if (r->started < r->cnt)
+            {
+              list_insert_ordered (&c->sorted, &r->sort_elem,
+                                   request_less, NULL);
+              list_push_front (&c->fifo[r->write], &r->fifo_elem);
+              break;
+            }
+          list_push_back (&done, &r->sort_elem);
+
+          /* Merge the next request if it takes up where R ends. */
+          if (e == list_end (&c->sorted))
+            break;
+          next = list_entry (e, struct block_request, sort_elem);
+          if (next->dev != d || next->write != write || next->started > 0
+              || next->sector != sec_no + n
+              || next->cnt > MAX_XFER_SECTORS - n)
+            break;
+          r = next;
+          n = take_sectors (c, r, n);
+        }
+      c->head_dev = d->dev_no;
+      c->head = sec_no + n;
+      lock_release (&c->lock);
+
+      if (!d->dma || !dma_command (d, sec_no, n, c->bufs, write))
+        pio_command (d, sec_no, n, c->bufs, write);
 
-      for (dev_no = 0; dev_no < 2; dev_no++) 
+      while (!list_empty (&done))
         {
-          struct disk *d = disk_get (chan_no, dev_no);
-          if (d != NULL && d->is_ata) 
-            printf ("%s: %lld reads, %lld writes\n",
-                    d->name, d->read_cnt, d->write_cnt);
+          r = list_entry (list_pop_front (&done), struct block_request,
+                          sort_elem);
+          r->done (r);
         }
     }
 }
 
-/* Returns the disk numbered DEV_NO--either 0 or 1 for master or
-   slave, respectively--within the channel numbered CHAN_NO.
-
-   Pintos uses disks this way:
-        0:0 - boot loader, command line args, and operating system kernel
-        0:1 - file system
-        1:0 - scratch
-        1:1 - swap
-*/
-struct disk *
-disk_get (int chan_no, int dev_no) 
+/* Picks the request channel C should serve next: a cache flush
+   at the front of the writes, the oldest read or write if it is
+   past its deadline, otherwise the first at or past the head in
+   C-LOOK order.  The caller must hold C's lock, and the queue
+   must not be empty.  A flush is never in the sorted queue, and
+   while one is queued but not at the front, the writes ahead of
+   it are. */
+static struct block_request *
+next_request (struct channel *c) 
 {
-  ASSERT (dev_no == 0 || dev_no == 1);
+  int64_t now = timer_ticks ();
+  struct list_elem *e;
+  int i;
+
+  if (!list_empty (&c->fifo[1]))
+    {
+      struct block_request *r = list_entry (list_front (&c->fifo[1]),
+                                            struct block_request,
+                                            fifo_elem);
+      if (r->cnt == 0)
+        return r;
+    }
+
+  for (i = 0; i < 2; i++)
+    if (!list_empty (&c->fifo[i]))
+      {
+        struct block_request *r = list_entry (list_front (&c->fifo[i]),
+                                              struct block_request,
+                                              fifo_elem);
+        if (r->deadline <= now)
+          return r;
+      }
 
-  if (chan_no < (int) CHANNEL_CNT) 
+  for (e = list_begin (&c->sorted); e != list_end (&c->sorted);
+       e = list_next (e))
     {
-      struct disk *d = &channels[chan_no].devices[dev_no];
-      if (d->is_ata)
-        return d; 
+      struct block_request *r = list_entry (e, struct block_request,
+                                            sort_elem);
+      const struct disk *d = r->dev;
+      if (d->dev_no > c->head_dev
+          || (d->dev_no == c->head_dev
+              && r->sector + r->started >= c->head))
+        return r;
     }
-  return NULL;
+  return list_entry (list_front (&c->sorted), struct block_request,
+                     sort_elem);
 }
 
-/* Returns the size of disk D, measured in DISK_SECTOR_SIZE-byte
-   sectors. */
-disk_sector_t
-disk_size (struct disk *d) 
+/* Adds to the command being built in channel C, which has N
+   sectors so far, as many of R's remaining sectors as fit.
+   Returns the command's new number of sectors.  The caller must
+   hold C's lock. */
+static size_t
+take_sectors (struct channel *c, struct block_request *r, size_t n) 
 {
-  ASSERT (d != NULL);
-  
-  return d->capacity;
+  for (; r->started < r->cnt && n < MAX_XFER_SECTORS; r->started++, n++)
+    c->bufs[n] = (r->bufs != NULL ? r->bufs[r->started]
+                  : r->buffer + r->started * DISK_SECTOR_SIZE);
+  return n;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for DISK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-void
-disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) 
+/* Orders requests by device, then by the next sector to
+   transfer. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED) 
 {
-  struct channel *c;
-  
-  ASSERT (d != NULL);
-  ASSERT (buffer != NULL);
+  const struct block_request *a = list_entry (a_, struct block_request,
+                                              sort_elem);
+  const struct block_request *b = list_entry (b_, struct block_request,
+                                              sort_elem);
+  const struct disk *a_disk = a->dev;
+  const struct disk *b_disk = b->dev;
+
+  if (a_disk->dev_no != b_disk->dev_no)
+    return a_disk->dev_no < b_disk->dev_no;
+  return a->sector + a->started < b->sector + b->started;
+}
 
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+/* Transfers CNT sectors, at most MAX_XFER_SECTORS, starting at
+   SEC_NO between disk D and BUFS, sector I in BUFS[I], by PIO with
+   a single command.  Writes to the disk if WRITE, reads
+   otherwise.  The disk interrupts once per D->multiple sectors.
+   Only D's channel's I/O thread may call this. */
+static void
+pio_command (struct disk *d, disk_sector_t sec_no, size_t cnt,
+             void *const bufs[], bool write)
+{
+  struct channel *c = d->channel;
+  size_t i, j;
+
+  select_sector (d, sec_no, cnt);
+  if (write)
+    issue_command (c, d->multiple > 1
+                   ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  else
+    issue_command (c, d->multiple > 1
+                   ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+
+  /* The data goes in blocks of D->multiple sectors, the last
+     block taking what is left.  A write sends each block when the
+     disk asks for it and is acknowledged by an interrupt; a read
+     is told by an interrupt that a block is ready. */
+  for (i = 0; i < cnt; i += d->multiple)
+    {
+      size_t block = cnt - i < d->multiple ? cnt - i : d->multiple;
+
+      if (!write)
+        sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+               write ? "write" : "read", sec_no + i);
+      for (j = 0; j < block; j++)
+        if (write)
+          output_sector (c, bufs[i + j]);
+        else
+          input_sector (c, bufs[i + j]);
+      if (write)
+        sema_down (&c->completion_wait);
+    }
+}
+
+/* Transfers CNT sectors as pio_command() does, but by bus-master
+   DMA.  The CPU is free for other threads until the one interrupt
+   at the end.  Returns false, with nothing transferred, if the
+   buffers are not all in kernel memory.  If the transfer fails,
+   turns DMA off for D and returns false, for the caller to fall
+   back to PIO.  Only D's channel's I/O thread may call this. */
+static bool
+dma_command (struct disk *d, disk_sector_t sec_no, size_t cnt,
+             void *const bufs[], bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_READ;
+  uint8_t bm_status;
+
+  if (!fill_prdt (c, cnt, bufs))
+    return false;
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_ERR | BM_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_START);
   sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  d->read_cnt++;
-  lock_release (&c->lock);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_ERR | BM_INTR);
+  wait_while_busy (d);
+  if ((bm_status & BM_ERR) != 0
+      || (inb (reg_alt_status (c)) & STA_ERR) != 0)
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   DISK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-void
-disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
+/* Describes the memory of a transfer of CNT sectors, sector I in
+   BUFS[I], in channel C's PRD table.  Neighboring sectors that
+   are contiguous in physical memory share entries.  Returns false
+   if some buffer is not in kernel memory, which is the only
+   memory whose physical address we know. */
+static bool
+fill_prdt (struct channel *c, size_t cnt, void *const bufs[])
 {
-  struct channel *c;
-  
-  ASSERT (d != NULL);
-  ASSERT (buffer != NULL);
+  size_t i, n = 0;
 
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
+  for (i = 0; i < cnt; i++)
+    {
+      void *sector = bufs[i];
+      uintptr_t addr, end;
+
+      if (!is_kernel_vaddr (sector))
+        return false;
+      addr = vtop (sector);
+      end = addr + DISK_SECTOR_SIZE;
+      while (addr < end)
+        {
+          uintptr_t next = (addr / PRD_BOUNDARY + 1) * PRD_BOUNDARY;
+          uint32_t size = (next < end ? next : end) - addr;
+          struct prd *last = n > 0 ? &c->prdt[n - 1] : NULL;
+
+          if (last != NULL && addr % PRD_BOUNDARY != 0
+              && last->addr + last->size == addr)
+            last->size += size;
+          else
+            {
+              ASSERT (n < PRD_CNT);
+              c->prdt[n].addr = addr;
+              c->prdt[n].size = size;
+              c->prdt[n].flags = 0;
+              n++;
+            }
+          addr += size;
+        }
+    }
+  c->prdt[n - 1].flags = PRD_EOT;
+  return true;
+}
+
+/* Asks disk D to write the contents of its write cache to the
+   media, and waits until it has.  Only D's channel's I/O thread
+   may call this. */
+static void
+flush_command (struct disk *d) 
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  issue_command (c, CMD_FLUSH_CACHE);
   sema_down (&c->completion_wait);
-  d->write_cnt++;
-  lock_release (&c->lock);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) != 0)
+    printf ("%s: cache flush failed\n", d->name);
 }
-
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -360,8 +761,9 @@ check_device_type (struct disk *d)
 }
 
 /* Sends an IDENTIFY DEVICE command to disk D and reads the
-   response.  Initializes D's capacity member based on the result
-   and prints a message describing the disk to the console. */
+   response.  Initializes D's capacity member based on the result,
+   prints a message describing the disk to the console, and
+   registers D as a block device. */
 static void
 identify_ata_device (struct disk *d) 
 {
@@ -374,7 +776,7 @@ identify_ata_device (struct disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -402,6 +804,105 @@ identify_ata_device (struct disk *d)
   printf ("\", serial \"");
   print_ata_string ((char *) &id[10], 20);
   printf ("\"\n");
+
+  /* Word 47 gives the most sectors the disk can move per
+     interrupt with READ and WRITE MULTIPLE, 0 if it has no such
+     commands.  Bit 8 of word 49 says whether it can do DMA. */
+  set_multiple_mode (d, id[47] & 0xff);
+  d->dma = c->bm_base != 0 && (id[49] & 0x100) != 0;
+  if (d->dma)
+    printf ("%s: using DMA\n", d->name);
+
+  /* Word 83 is valid if its top bits are 01; then bit 12 says
+     whether the disk has FLUSH CACHE. */
+  d->flush = (id[83] & 0xc000) == 0x4000 && (id[83] & 0x1000) != 0;
+
+  block_register (d->name, d->capacity, &ata_operations, d);
+}
+
+/* Asks disk D to move the largest power of 2 sectors up to MAX
+   and MAX_MULTIPLE per interrupt in READ and WRITE MULTIPLE, and
+   sets D's multiple member to the number it agreed to.  D is left
+   at 1, and the plain commands used, if it does not agree. */
+static void
+set_multiple_mode (struct disk *d, int max) 
+{
+  struct channel *c = d->channel;
+  int multiple;
+
+  if (max > MAX_MULTIPLE)
+    max = MAX_MULTIPLE;
+  for (multiple = 1; multiple * 2 <= max; multiple *= 2)
+    continue;
+  if (multiple < 2)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Reads the 32-bit register at offset REG of the configuration
+   space of PCI function FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg) 
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit register at offset REG of the
+   configuration space of PCI function FUNC of device DEV on
+   bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value) 
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can act as a bus
+   master, such as the PIIX's, and turns bus mastering on.
+   Returns the base of its bus-master registers, or 0 if there is
+   no such controller. */
+static uint16_t
+find_bus_master (void) 
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (dev, func, 0x00);
+        uint32_t class = pci_read_config (dev, func, 0x08) >> 8;
+        uint32_t bar4;
+
+        if ((id & 0xffff) == 0xffff)
+          continue;
+
+        /* Class 1, subclass 1 is IDE; bit 7 of the programming
+           interface, bus-master capable. */
+        if ((class >> 8) != 0x0101 || (class & 0x80) == 0)
+          continue;
+        bar4 = pci_read_config (dev, func, 0x20);
+        if ((bar4 & 1) == 0 || (bar4 & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering in the command
+           register. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x05);
+        return bar4 & 0xfffc;
+      }
+  return 0;
 }
 
 /* Prints STRING, which consists of SIZE bytes in a funky format:
@@ -426,18 +927,20 @@ print_ata_string (char *string, size_t size)
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and
+   MAX_XFER_SECTORS, to the disk's sector selection registers.
+   (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) 
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) 
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < d->capacity);
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_XFER_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_XFER_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -448,7 +951,7 @@ select_sector (struct disk *d, disk_sector_t sec_no)
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
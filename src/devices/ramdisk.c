@@ -0,0 +1,102 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A RAM disk: a block device kept in kernel pages, for running
+   the file system or swap without the cost of an ATA disk.  Its
+   contents do not survive a reboot.
+
+   The pages need not be contiguous, so the disk is an array of
+   pointers to them, each holding SECTORS_PER_PAGE sectors. */
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Kernel pages the RAM disk always leaves free, for the thread
+   stacks, page tables and malloc() arenas the kernel needs once
+   it is up. */
+#define KERNEL_RESERVE 128
+
+static uint8_t **pages;
+
+static const struct block_operations ramdisk_operations;
+
+/* Creates RAM disk "rd0" of SECTORS sectors, zeroed, and
+   registers it as a block device.  Makes the disk smaller, with
+   a warning, if the kernel pool cannot supply that much and
+   still keep KERNEL_RESERVE pages free. */
+void
+ramdisk_init (disk_sector_t sectors) 
+{
+  size_t page_cnt = DIV_ROUND_UP (sectors, SECTORS_PER_PAGE);
+  size_t i;
+
+  if (page_cnt == 0)
+    return;
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("rd0: out of memory");
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      if (palloc_kernel_free_cnt () <= KERNEL_RESERVE)
+        break;
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        break;
+    }
+  if (i < page_cnt)
+    {
+      printf ("rd0: only %zu of %zu pages available\n", i, page_cnt);
+      sectors = i * SECTORS_PER_PAGE;
+      if (i == 0)
+        {
+          free (pages);
+          pages = NULL;
+          return;
+        }
+    }
+
+  printf ("rd0: %'"PRDSNu" sector RAM disk\n", sectors);
+  block_register ("rd0", sectors, &ramdisk_operations, NULL);
+}
+
+/* Returns the address of SECTOR. */
+static uint8_t *
+sector_addr (disk_sector_t sector) 
+{
+  return pages[sector / SECTORS_PER_PAGE]
+         + sector % SECTORS_PER_PAGE * DISK_SECTOR_SIZE;
+}
+
+static void
+ramdisk_read (void *aux UNUSED, disk_sector_t sector, size_t cnt,
+              void *const bufs[]) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    memcpy (bufs[i], sector_addr (sector + i), DISK_SECTOR_SIZE);
+}
+
+static void
+ramdisk_write (void *aux UNUSED, disk_sector_t sector, size_t cnt,
+               const void *const bufs[]) 
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    memcpy (sector_addr (sector + i), bufs[i], DISK_SECTOR_SIZE);
+}
+
+/* A RAM disk has nothing to queue and no cache to flush. */
+static const struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+  };
@@ -1,232 +1,915 @@
 #include <debug.h>
+#include <round.h>
+#include <stdlib.h>
+#include <string.h>
 #include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/frame.h"
+#endif
 
-//bool can_read_ahead = true;
-struct list aheads;
-struct ahead{
-  disk_sector_t sector;
-  struct list_elem e;
+/* Cache memory comes in whole pages from the user pool, each
+   carved into SLOTS_PER_PAGE sector slots.  Drawing on the user
+   pool lets the frame table take pages back under pressure via
+   cache_shrink(). */
+#define SLOTS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Target size of the cache in sectors, set by -cache. */
+size_t cache_max_sectors = BUFFER_SIZE;
+
+/* The writeback thread runs every WRITE_BEHIND_PERIOD ticks.  It
+   writes back entries that have been dirty for DIRTY_EXPIRE ticks
+   and, in a shard with more than DIRTY_LIMIT percent of its slots
+   dirty, the oldest others as well. */
+#define WRITE_BEHIND_PERIOD (TIMER_FREQ / 4)
+#define DIRTY_EXPIRE (5 * TIMER_FREQ)
+#define DIRTY_LIMIT 50
+
+/* Entries picked for write-back are gathered into a batch of up
+   to FLUSH_BATCH entries and written in ascending sector order.
+   Each picked entry also pulls in up to FLUSH_RUN dirty sectors
+   directly following it, which live in other shards. */
+#define FLUSH_BATCH 64
+#define FLUSH_RUN 8
+
+struct flush_batch {
+  struct cache_entry *entries[FLUSH_BATCH];
+  size_t cnt;
+};
+
+/* A run of consecutive entries of a batch being written back
+   asynchronously.  Its entries stay pinned and read-locked until
+   the disk is done with them. */
+struct flush_io {
+  struct block_request req;
+  struct cache_entry *entries[FLUSH_BATCH];
+  void *bufs[FLUSH_BATCH];
+};
+
+/* Number of flush_ios submitted and not complete yet. */
+static size_t flush_inflight;
+static struct lock flush_lock;
+static struct condition flush_idle;     /* Signaled when it hits 0. */
+
+/* One page of cache memory and the entries for its slots. */
+struct cache_page {
+  void *kpage;
+  struct cache_entry slots[SLOTS_PER_PAGE];
+  struct list_elem elem;        /* Element in the shard's page list. */
+};
+
+/* One slice of the buffer cache.  The shard lock only guards the
+   index, the clock ring and the pin counts; it is never held
+   across disk I/O, so a miss on one sector does not stall hits
+   on any other. */
+struct cache_shard {
+  struct lock lock;
+  struct hash map;              /* Sector-keyed index. */
+  struct list ring;             /* Clock ring of entries in use. */
+  struct list_elem *hand;       /* Clock hand, NULL before first sweep. */
+  struct list free;             /* Slots holding no sector. */
+  struct list dirty;            /* Dirty entries, oldest first. */
+  size_t dirty_cnt;             /* Length of dirty. */
+  struct list pages;            /* Pages backing this shard. */
+  size_t page_cnt;              /* Number of pages. */
+  struct condition unpinned;    /* Signaled when an entry's pin drops. */
 };
-void read_ahead (disk_sector_t );
 
-struct condition empty;
+static struct cache_shard shards[CACHE_SHARDS];
+
+/* Per-shard page bounds.  A shard never shrinks below the
+   minimum and only grows back up to the maximum. */
+static size_t shard_min_pages;
+static size_t shard_max_pages;
+
+/* Sectors waiting for the readahead thread, as a ring.  The
+   queue is bounded: read-ahead is only a hint, so requests that
+   find it full are dropped rather than waited on. */
+#define READ_AHEAD_QUEUE 64
+static disk_sector_t ahead_queue[READ_AHEAD_QUEUE];
+static size_t ahead_head;       /* Index of the oldest request. */
+static size_t ahead_cnt;        /* Number of queued requests. */
+static struct lock ahead_lock;
+static struct condition ahead_ready;
+static void read_ahead (void *);
+
+static struct cache_entry *cache_get (disk_sector_t, bool write, bool load);
+static struct cache_entry *cache_claim (disk_sector_t, bool *hit);
+static bool cache_may_grow (void);
+static void cache_unpin (struct cache_entry *);
+static void load_window (disk_sector_t, size_t cnt);
+static void load_done (struct block_request *);
+static size_t flush_run (struct cache_entry **, size_t cnt);
+static void flush_done (struct block_request *);
+static void flush_unpin (struct cache_entry *);
+static struct cache_entry *cache_lookup (struct cache_shard *, disk_sector_t);
+static struct cache_entry *cache_evict_SC (struct cache_shard *);
+static void cache_add_page (struct cache_shard *, void *kpage);
+static bool cache_remove_page (struct cache_shard *);
+static void dirty_remove (struct cache_shard *, struct cache_entry *);
+static bool flush_pick (struct cache_shard *, struct cache_entry *,
+    struct flush_batch *, bool force);
+static void flush_pick_due (struct cache_shard *, int64_t expired,
+    struct flush_batch *);
+static void flush_extend (struct flush_batch *);
+static void flush_write (struct flush_batch *);
+static void clock_remove (struct cache_shard *, struct cache_entry *);
+static struct list_elem *clock_next (struct cache_shard *, struct list_elem *);
+static unsigned cache_hash_func (const struct hash_elem *, void *);
+static bool cache_less_func (const struct hash_elem *,
+    const struct hash_elem *, void *);
+
+static inline struct cache_shard *shard_of (disk_sector_t sector){
+  return &shards[sector % CACHE_SHARDS];
+}
+
+/* Sets up the shards with cache_max_sectors worth of slots, in
+   one contiguous run of pages if the user pool allows it and
+   with the minimum otherwise. */
 void cache_init (void){
-  list_init (&cache);
-  cond_init (&empty);
-  list_init (&aheads); 
-  lock_init (&cache_lock);
-  cache_size = 0;
+  size_t shard_sectors = SLOTS_PER_PAGE * CACHE_SHARDS;
+  size_t page_cnt;
+  uint8_t *kpages;
+  int i;
+
+  shard_min_pages = DIV_ROUND_UP (BUFFER_SIZE, shard_sectors);
+  shard_max_pages = DIV_ROUND_UP (cache_max_sectors, shard_sectors);
+  if (shard_max_pages < shard_min_pages)
+    shard_max_pages = shard_min_pages;
+
+  page_cnt = shard_max_pages;
+  kpages = palloc_get_multiple (PAL_USER, page_cnt * CACHE_SHARDS);
+  if (kpages == NULL){
+    page_cnt = shard_min_pages;
+    kpages = palloc_get_multiple (PAL_USER | PAL_ASSERT,
+        page_cnt * CACHE_SHARDS);
+  }
+
+  for (i = 0; i < CACHE_SHARDS; i++){
+    struct cache_shard *s = &shards[i];
+    size_t j;
+
+    lock_init (&s->lock);
+    hash_init (&s->map, cache_hash_func, cache_less_func, NULL);
+    list_init (&s->ring);
+    s->hand = NULL;
+    list_init (&s->free);
+    list_init (&s->dirty);
+    s->dirty_cnt = 0;
+    list_init (&s->pages);
+    s->page_cnt = 0;
+    cond_init (&s->unpinned);
+    for (j = 0; j < page_cnt; j++)
+      cache_add_page (s, kpages + (i * page_cnt + j) * PGSIZE);
+  }
+  lock_init (&ahead_lock);
+  cond_init (&ahead_ready);
+  lock_init (&flush_lock);
+  cond_init (&flush_idle);
   thread_create ("writeback", 0, write_back, NULL);
-  thread_create ("readahead", 0, read_ahead, NULL);
+  thread_create ("readahead", PRI_DEFAULT, read_ahead, NULL);
 }
 
+/* Gives up to PAGE_CNT cache pages back to the user pool and
+   returns how many were freed.  Only pages whose slots are all
+   clean and unpinned are taken, so this never waits on I/O or
+   on another thread's use of the cache; the write-behind thread
+   keeps such pages available.  Called by the frame table when
+   the user pool runs dry. */
+size_t cache_shrink (size_t page_cnt){
+  static int next_shard;
+  size_t freed = 0;
+  int tries;
+
+  for (tries = 0; tries < CACHE_SHARDS && freed < page_cnt; tries++){
+    struct cache_shard *s = &shards[next_shard];
+    next_shard = (next_shard + 1) % CACHE_SHARDS;
+
+    lock_acquire (&s->lock);
+    if (cache_remove_page (s)){
+      freed++;
+      tries = -1;
+    }
+    lock_release (&s->lock);
+  }
+  return freed;
+}
 
+/* Writes every dirty entry back to disk at shutdown. */
 void cache_bye (void){
-  lock_acquire (&cache_lock);
+  cache_flush_all ();
+}
+
+/* Writes every dirty entry back to disk and waits until all
+   write-back in progress, its own or the writeback thread's, is
+   complete, then flushes the disk's own write cache.  Entries
+   stay cached. */
+void cache_flush_all (void){
+  cache_flush_before (INT64_MAX);
+}
+
+/* Like cache_flush_all(), but writes only the entries queued as
+   dirty at or before tick BEFORE.  Dirty lists are oldest first,
+   so this stops at the first younger entry of each shard. */
+void cache_flush_before (int64_t before){
+  struct flush_batch b;
+  int i;
+
+  for (i = 0; i < CACHE_SHARDS; i++){
+    struct cache_shard *s = &shards[i];
+    do {
+      b.cnt = 0;
+      lock_acquire (&s->lock);
+      while (!list_empty (&s->dirty) && b.cnt < FLUSH_BATCH){
+        struct cache_entry *c = list_entry (list_front (&s->dirty),
+            struct cache_entry, d_elem);
+        if (c->dirtied > before)
+          break;
+        flush_pick (s, c, &b, true);
+      }
+      lock_release (&s->lock);
+      flush_write (&b);
+    } while (b.cnt > 0);
+  }
+
+  lock_acquire (&flush_lock);
+  while (flush_inflight > 0)
+    cond_wait (&flush_idle, &flush_lock);
+  lock_release (&flush_lock);
+  block_flush (filesys_disk);
+}
+
+/* Writes SECTOR back to disk now if it is cached and dirty, even
+   if a flusher already has it in hand, so that it is on disk when
+   this returns. */
+void cache_flush (disk_sector_t sector){
+  struct cache_shard *s = shard_of (sector);
   struct cache_entry *c;
-  struct list_elem *e = list_begin (&cache);
-  struct list_elem *next;
-  while (e != list_end (&cache)){
-	next = list_next (e);
-	struct cache_entry *c = list_entry (e, struct cache_entry, c_elem);
-//	if (c->in_use>0)
-//	  continue;
-	if (c->dirty){
-	  disk_write (filesys_disk, c->sector, c->buf);
-	  c->dirty = false;
-	}
-	list_remove (&c->c_elem);
-	free (c);
-	e= next;
-	cache_size--;
-  }
-  lock_release (&cache_lock);	
-}
-
-void cache_destroy (void){
-  lock_acquire (&cache_lock);
+
+  lock_acquire (&s->lock);
+  c = cache_lookup (s, sector);
+  if (c == NULL || !c->dirty){
+    lock_release (&s->lock);
+    return;
+  }
+  c->in_use++;
+  lock_release (&s->lock);
+
+  rwlock_acquire_read (&c->sector_lock);
+  if (c->dirty){
+    block_write (filesys_disk, c->sector, c->buf);
+    c->dirty = false;
+  }
+  rwlock_release (&c->sector_lock);
+
+  lock_acquire (&s->lock);
+  if (!c->flushing)
+    dirty_remove (s, c);
+  if (--c->in_use == 0)
+    cond_signal (&s->unpinned, &s->lock);
+  lock_release (&s->lock);
+}
+
+/* Returns the entry for SECTOR, pinned and locked for writing if
+   WRITE is true or for reading otherwise.  The caller must hand
+   it back with cache_release(). */
+struct cache_entry *cache_return (disk_sector_t sector, bool write){
+  return cache_get (sector, write, true);
+}
+
+/* Unlocks and unpins C.  If DIRTY, C must have been obtained for
+   writing, and is marked to be written back. */
+void cache_release (struct cache_entry *c, bool dirty){
+  struct cache_shard *s = shard_of (c->sector);
+
+  if (dirty){
+    ASSERT (rwlock_held_by_current_thread (&c->sector_lock));
+    c->dirty = true;
+  }
+  rwlock_release (&c->sector_lock);
+
+  lock_acquire (&s->lock);
+  /* An entry keeps its place in the dirty list, and so its age,
+     until it is written back. */
+  if (dirty && !c->queued){
+    c->queued = true;
+    c->dirtied = timer_ticks ();
+    list_push_back (&s->dirty, &c->d_elem);
+    s->dirty_cnt++;
+  }
+  if (--c->in_use == 0)
+    cond_signal (&s->unpinned, &s->lock);
+  lock_release (&s->lock);
+}
+
+/* Copies SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void cache_read (disk_sector_t sector, void *buffer, off_t ofs, size_t size){
   struct cache_entry *c;
-  struct list_elem *e = list_begin (&cache);
-  struct list_elem *next;
-  while (e != list_end (&cache)){
-	next = list_next (e);
-	struct cache_entry *c = list_entry (e, struct cache_entry, c_elem);
-	if (c->in_use>0)
-	  continue;
-	if (c->dirty){
-	  disk_write (filesys_disk, c->sector, c->buf);
-	  c->dirty = false;
-	}
-	list_remove (&c->c_elem);
-	free (c);
-	e= next;
-	cache_size--;
-  }
-  lock_release (&cache_lock);
-
-	
-}
-struct cache_entry *cache_lookup (disk_sector_t sector){
+
+  ASSERT (ofs >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+  c = cache_get (sector, false, true);
+  memcpy (buffer, c->buf + ofs, size);
+  cache_release (c, false);
+}
+
+/* Copies SIZE bytes from BUFFER to offset OFS of SECTOR.  A write
+   of the whole sector does not read the old contents first. */
+void cache_write (disk_sector_t sector, const void *buffer, off_t ofs,
+    size_t size){
   struct cache_entry *c;
-  struct list_elem *e;
-  for (e = list_begin (&cache);
-	  e != list_end (&cache);
-	  e = list_next (e)){
-	c = list_entry (e, struct cache_entry, c_elem);
-	if (c->sector == sector){
-	  return c;
-	}
+
+  ASSERT (ofs >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+  c = cache_get (sector, true, size < DISK_SECTOR_SIZE);
+  memcpy (c->buf + ofs, buffer, size);
+  cache_release (c, true);
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache and
+   returns once they are there.  Each run of them that is not
+   cached yet is read from disk with a single command. */
+void cache_load (disk_sector_t sector, size_t cnt){
+  while (cnt > 0){
+    size_t n = cnt < CACHE_SHARDS ? cnt : CACHE_SHARDS;
+    load_window (sector, n);
+    sector += n;
+    cnt -= n;
   }
-  return NULL;
 }
-	
-struct cache_entry *cache_return (disk_sector_t sector, bool write){
-  //init_read_ahead (sector+1);
-  //printf("let's put ahead\n");
-  put_read_ahead (sector+1);
-  lock_acquire(&cache_lock);
- // put_ahead (sector+1)
- // lock_release (&cache_lock);
-  struct cache_entry *c = cache_lookup (sector);
-  
-  /*struct list_elem *e;
-  for (e = list_begin (&cache);
-	  e != list_end (&cache);
-	  e = list_next (e)){
-	c = list_entry (e, struct cache_entry, c_elem);
-	if (c->sector == sector){
-	  c->in_use = true;
-	  c->dirty |= write;
-	  c->access = true;
-	  lock_release (&cache_lock);
-	  return c;
-	}
-  }*/
-  if (c){
-	c->in_use ++;
-	c->dirty |= write;
-	c->access =true;
-	lock_release (&cache_lock);
-	return c;
-  }
-  c = cache_evict_SC (sector, write);
-  ASSERT (c != NULL);
-  lock_release (&cache_lock);
+
+/* Loads CNT sectors starting at SECTOR, at most one per shard, so
+   that the slots claimed for them cannot leave a shard with
+   nothing to evict.  The runs of misses are queued together and
+   then waited for together. */
+static void load_window (disk_sector_t sector, size_t cnt){
+  struct block_request reqs[CACHE_SHARDS];
+  struct cache_entry *claimed[CACHE_SHARDS];
+  void *bufs[CACHE_SHARDS];
+  struct semaphore done;
+  size_t i, n = 0, first = 0, runs = 0;
+
+  ASSERT (cnt <= CACHE_SHARDS);
+  sema_init (&done, 0);
+  for (i = 0; i <= cnt; i++){
+    bool hit = true;
+    struct cache_entry *c = i < cnt ? cache_claim (sector + i, &hit) : NULL;
+
+    if (!hit){
+      claimed[n] = c;
+      bufs[n++] = c->buf;
+      continue;
+    }
+    if (c != NULL)
+      cache_unpin (c);
+
+    /* A hit or the end closes the run of misses before it. */
+    if (first < n){
+      struct block_request *r = &reqs[runs++];
+      r->block = filesys_disk;
+      r->sector = claimed[first]->sector;
+      r->cnt = n - first;
+      r->write = false;
+      r->buffer = NULL;
+      r->bufs = bufs + first;
+      r->done = load_done;
+      r->aux = &done;
+      block_submit (r);
+    }
+    first = n;
+  }
+
+  for (i = 0; i < runs; i++)
+    sema_down (&done);
+  for (i = 0; i < n; i++)
+    cache_release (claimed[i], false);
+}
+
+/* Tells load_window() that read R is complete. */
+static void load_done (struct block_request *r){
+  sema_up (r->aux);
+}
+
+/* Pins the entry for SECTOR and locks it for writing if WRITE,
+   for reading otherwise.  On a miss a slot is claimed from the
+   shard, and filled from disk if LOAD or with zeros if not; the
+   read happens with only the new entry locked. */
+static struct cache_entry *cache_get (disk_sector_t sector, bool write,
+    bool load){
+  bool hit;
+  struct cache_entry *c = cache_claim (sector, &hit);
+
+  if (hit){
+    if (write)
+      rwlock_acquire_write (&c->sector_lock);
+    else
+      rwlock_acquire_read (&c->sector_lock);
+    return c;
+  }
+
+  if (load)
+    block_read (filesys_disk, sector, c->buf);
+  else
+    memset (c->buf, 0, DISK_SECTOR_SIZE);
+
+  if (!write){
+    rwlock_release (&c->sector_lock);
+    rwlock_acquire_read (&c->sector_lock);
+  }
   return c;
 }
-struct cache_entry *cache_evict_SC (disk_sector_t sector, bool write){
+
+/* Pins the entry for SECTOR and sets *HIT to whether it was
+   cached.  A cached entry is returned unlocked.  Otherwise a slot
+   is claimed from the shard, entered in the index and returned
+   locked for writing, for the caller to fill in. */
+static struct cache_entry *cache_claim (disk_sector_t sector, bool *hit){
+  struct cache_shard *s = shard_of (sector);
   struct cache_entry *c;
-  if (cache_size < BUFFER_SIZE){
-	cache_size++;
-	c = malloc (sizeof *c);
-	if (!c)
-	  PANIC("NO MEM in cache_evict_SC");
-	c->in_use = 0;
-	list_push_back (&cache, &c->c_elem);
-  }
-  else{
-	bool second = true;
-
-	struct list_elem *e;
-	while (second){
-	for ( e = list_begin (&cache);
-		e != list_end (&cache);
-		e = list_next (e)){
-	  c = list_entry (e, struct cache_entry, c_elem);
-	  if (c->in_use > 0)
-		continue;
-	  if (c->access){
-		c->access = false;
-	  }else{
-		//list_remove (e);
-		if (c->dirty){
-		  disk_write (filesys_disk, c->sector, &c->buf);
-		  
-		}
-		//free(c->buf);
-		second = false;
-		break;
-	  }
-	}
-	}
+
+  lock_acquire (&s->lock);
+  for (;;){
+    c = cache_lookup (s, sector);
+    if (c != NULL){
+      c->in_use++;
+      c->access = true;
+      lock_release (&s->lock);
+      *hit = true;
+      return c;
+    }
+
+    if (list_empty (&s->free) && s->page_cnt < shard_max_pages
+        && cache_may_grow ()){
+      void *kpage = palloc_get_page (PAL_USER);
+      if (kpage != NULL)
+        cache_add_page (s, kpage);
+    }
+    if (!list_empty (&s->free)){
+      c = list_entry (list_pop_front (&s->free), struct cache_entry, c_elem);
+      /* New slots join the ring just behind the hand, so they
+         are the last to be considered for eviction. */
+      if (s->hand == NULL)
+        list_push_back (&s->ring, &c->c_elem);
+      else
+        list_insert (s->hand, &c->c_elem);
+      break;
+    }
+
+    c = cache_evict_SC (s);
+    if (c == NULL){
+      /* Every entry is pinned. */
+      cond_wait (&s->unpinned, &s->lock);
+      continue;
+    }
+    if (!c->dirty){
+      hash_delete (&s->map, &c->h_elem);
+      dirty_remove (s, c);
+      break;
+    }
+
+    /* Write the victim back under its read lock, so hits on it
+       can still be served, then look again: the sector may have
+       been loaded by someone else or the victim touched while
+       the shard lock was dropped. */
+    c->in_use++;
+    lock_release (&s->lock);
+    rwlock_acquire_read (&c->sector_lock);
+    if (c->dirty){
+      block_write (filesys_disk, c->sector, c->buf);
+      c->dirty = false;
+    }
+    rwlock_release (&c->sector_lock);
+    lock_acquire (&s->lock);
+    if (--c->in_use == 0)
+      cond_signal (&s->unpinned, &s->lock);
   }
 
-  c->in_use = 1;
+  /* C is unpinned, so nobody holds its lock and taking it for
+     writing cannot block. */
   c->sector = sector;
-  c->dirty = write;
+  c->in_use = 1;
   c->access = true;
-  disk_read (filesys_disk, sector, c->buf);
+  c->dirty = false;
+  c->cached = true;
+  rwlock_acquire_write (&c->sector_lock);
+  hash_insert (&s->map, &c->h_elem);
+  lock_release (&s->lock);
+  *hit = false;
   return c;
 }
 
+/* Returns true if the cache may take another page from the user
+   pool.  Below the pageout thread's reserve it may not: pageout
+   would only evict process pages for it and then shrink the
+   cache again, and faults would find no free frame. */
+static bool cache_may_grow (void){
+#ifdef VM
+  return palloc_user_free_cnt () >= vm_frame_reserve ();
+#else
+  return true;
+#endif
+}
+
+/* Drops a pin on C, which the caller does not hold locked. */
+static void cache_unpin (struct cache_entry *c){
+  struct cache_shard *s = shard_of (c->sector);
+
+  lock_acquire (&s->lock);
+  if (--c->in_use == 0)
+    cond_signal (&s->unpinned, &s->lock);
+  lock_release (&s->lock);
+}
+
+/* Returns the entry caching SECTOR in shard S, or a null pointer
+   if SECTOR is not cached.  The caller must hold S's lock. */
+static struct cache_entry *cache_lookup (struct cache_shard *s,
+    disk_sector_t sector){
+  struct cache_entry key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&s->map, &key.h_elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, h_elem) : NULL;
+}
+
+/* Picks an unpinned victim in shard S with the second-chance
+   clock, leaving the hand on it.  Returns a null pointer if
+   every entry is pinned.  The caller must hold S's lock. */
+static struct cache_entry *cache_evict_SC (struct cache_shard *s){
+  size_t ring_cnt = list_size (&s->ring);
+  size_t scanned;
+
+  /* Two sweeps are enough: the first clears every access bit it
+     passes over. */
+  for (scanned = 0; scanned < 2 * ring_cnt; scanned++){
+    struct cache_entry *c;
+
+    s->hand = clock_next (s, s->hand);
+    c = list_entry (s->hand, struct cache_entry, c_elem);
+    if (c->in_use > 0)
+      continue;
+    if (c->access)
+      c->access = false;
+    else
+      return c;
+  }
+  return NULL;
+}
+
+/* Carves KPAGE into free slots of shard S.  The caller must hold
+   S's lock unless S is not yet in use. */
+static void cache_add_page (struct cache_shard *s, void *kpage){
+  struct cache_page *p = malloc (sizeof *p);
+  size_t i;
+
+  if (p == NULL){
+    palloc_free_page (kpage);
+    return;
+  }
+  p->kpage = kpage;
+  for (i = 0; i < SLOTS_PER_PAGE; i++){
+    struct cache_entry *c = &p->slots[i];
+    rwlock_init (&c->sector_lock);
+    c->buf = (uint8_t *) kpage + i * DISK_SECTOR_SIZE;
+    c->in_use = 0;
+    c->dirty = false;
+    c->flushing = false;
+    c->cached = false;
+    c->queued = false;
+    list_push_back (&s->free, &c->c_elem);
+  }
+  list_push_back (&s->pages, &p->elem);
+  s->page_cnt++;
+}
+
+/* Frees one page of shard S whose slots are all clean and
+   unpinned, if S is above its minimum size and has such a page.
+   Returns true if a page was freed.  The caller must hold S's
+   lock. */
+static bool cache_remove_page (struct cache_shard *s){
+  struct list_elem *e;
+
+  if (s->page_cnt <= shard_min_pages)
+    return false;
+
+  for (e = list_begin (&s->pages); e != list_end (&s->pages);
+      e = list_next (e)){
+    struct cache_page *p = list_entry (e, struct cache_page, elem);
+    size_t i;
+
+    for (i = 0; i < SLOTS_PER_PAGE; i++)
+      if (p->slots[i].in_use > 0 || p->slots[i].dirty
+          || p->slots[i].flushing)
+        break;
+    if (i < SLOTS_PER_PAGE)
+      continue;
+
+    for (i = 0; i < SLOTS_PER_PAGE; i++){
+      struct cache_entry *c = &p->slots[i];
+      if (c->cached){
+        hash_delete (&s->map, &c->h_elem);
+        clock_remove (s, c);
+        dirty_remove (s, c);
+      }
+      else
+        list_remove (&c->c_elem);
+    }
+    list_remove (&p->elem);
+    s->page_cnt--;
+    palloc_free_page (p->kpage);
+    free (p);
+    return true;
+  }
+  return false;
+}
+
+/* Takes C off S's dirty list if it is on it.  The caller must
+   hold S's lock. */
+static void dirty_remove (struct cache_shard *s, struct cache_entry *c){
+  if (c->queued){
+    list_remove (&c->d_elem);
+    c->queued = false;
+    s->dirty_cnt--;
+  }
+}
+
+/* Adds C, an entry of shard S, to batch B, pinning it, and takes
+   it off the dirty list.  Entries that turned out clean are just
+   taken off the list.  Entries already in another batch are left
+   alone unless FORCE.  Returns true if C was added.  The caller
+   must hold S's lock. */
+static bool flush_pick (struct cache_shard *s, struct cache_entry *c,
+    struct flush_batch *b, bool force){
+  if (b->cnt == FLUSH_BATCH || (c->flushing && !force))
+    return false;
+  dirty_remove (s, c);
+  if (!c->dirty)
+    return false;
+  c->in_use++;
+  c->flushing = true;
+  b->entries[b->cnt++] = c;
+  return true;
+}
+
+/* Adds the entries of S that are due for write-back to B: those
+   queued at or before EXPIRED, then if S is over its dirty limit
+   the oldest of the rest until it no longer is. */
+static void flush_pick_due (struct cache_shard *s, int64_t expired,
+    struct flush_batch *b){
+  struct list_elem *e, *next;
+  size_t limit;
+
+  lock_acquire (&s->lock);
+  limit = s->page_cnt * SLOTS_PER_PAGE * DIRTY_LIMIT / 100;
+  for (e = list_begin (&s->dirty);
+      e != list_end (&s->dirty) && b->cnt < FLUSH_BATCH; e = next){
+    struct cache_entry *c = list_entry (e, struct cache_entry, d_elem);
+    next = list_next (e);
+    if (c->dirtied > expired && s->dirty_cnt <= limit)
+      break;
+    flush_pick (s, c, b, false);
+  }
+  lock_release (&s->lock);
+}
+
+/* Adds to B the dirty sectors that directly follow each entry in
+   it, so that a run of sectors spread over the shards goes out in
+   one pass over the disk. */
+static void flush_extend (struct flush_batch *b){
+  size_t picked = b->cnt;
+  size_t i;
+
+  for (i = 0; i < picked; i++){
+    disk_sector_t sector = b->entries[i]->sector;
+    disk_sector_t next;
+
+    for (next = sector + 1; next <= sector + FLUSH_RUN; next++){
+      struct cache_shard *s = shard_of (next);
+      struct cache_entry *c;
+      bool added;
+
+      lock_acquire (&s->lock);
+      c = cache_lookup (s, next);
+      added = c != NULL && flush_pick (s, c, b, false);
+      lock_release (&s->lock);
+      if (!added)
+        break;
+    }
+  }
+}
+
+static int entry_sector_cmp (const void *a_, const void *b_,
+    void *aux UNUSED){
+  const struct cache_entry *a = *(struct cache_entry * const *) a_;
+  const struct cache_entry *b = *(struct cache_entry * const *) b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Starts writing the entries of batch B back in ascending sector
+   order, a run of consecutive sectors per disk request, and
+   returns without waiting for the disk.  Each entry is read-locked
+   until it is written, so that hits on it are still served, and
+   then unpinned. */
+static void flush_write (struct flush_batch *b){
+  size_t i;
+
+  sort (b->entries, b->cnt, sizeof *b->entries, entry_sector_cmp, NULL);
+  for (i = 0; i < b->cnt; )
+    i += flush_run (b->entries + i, b->cnt - i);
+}
+
+/* Submits a write of the dirty entries at the start of ENTRIES,
+   CNT entries sorted by sector, for as long as their sectors are
+   consecutive, and returns how many entries it dealt with.  The
+   entries are read-locked in ascending sector order.  A thread
+   waiting for a sector lock holds no others but freshly claimed
+   entries, which are in no batch, and the disk releases the locks
+   without taking any, so this cannot deadlock. */
+static size_t flush_run (struct cache_entry **entries, size_t cnt){
+  struct flush_io *io = malloc (sizeof *io);
+  size_t n;
+
+  for (n = 0; n < cnt; n++){
+    struct cache_entry *c = entries[n];
+
+    if (n > 0 && c->sector != entries[n - 1]->sector + 1)
+      break;
+    rwlock_acquire_read (&c->sector_lock);
+    if (!c->dirty || io == NULL){
+      /* Written back by someone else meanwhile, or there is no
+         memory to write it asynchronously. */
+      if (c->dirty){
+        block_write (filesys_disk, c->sector, c->buf);
+        c->dirty = false;
+      }
+      rwlock_release (&c->sector_lock);
+      if (n > 0)
+        break;
+      flush_unpin (c);
+      free (io);
+      return 1;
+    }
+    io->entries[n] = c;
+    io->bufs[n] = c->buf;
+  }
+
+  io->req.block = filesys_disk;
+  io->req.sector = entries[0]->sector;
+  io->req.cnt = n;
+  io->req.write = true;
+  io->req.buffer = NULL;
+  io->req.bufs = io->bufs;
+  io->req.done = flush_done;
+  io->req.aux = io;
+  lock_acquire (&flush_lock);
+  flush_inflight++;
+  lock_release (&flush_lock);
+  block_submit (&io->req);
+  return n;
+}
+
+/* Finishes the write-back of flush_io R->aux once it is on disk. */
+static void flush_done (struct block_request *r){
+  struct flush_io *io = r->aux;
+  size_t i;
+
+  for (i = 0; i < r->cnt; i++){
+    struct cache_entry *c = io->entries[i];
+    c->dirty = false;
+    rwlock_release (&c->sector_lock);
+    flush_unpin (c);
+  }
+  free (io);
+
+  lock_acquire (&flush_lock);
+  if (--flush_inflight == 0)
+    cond_broadcast (&flush_idle, &flush_lock);
+  lock_release (&flush_lock);
+}
+
+/* Ends C's part in a flush batch, unpinning it. */
+static void flush_unpin (struct cache_entry *c){
+  struct cache_shard *s = shard_of (c->sector);
+
+  lock_acquire (&s->lock);
+  c->flushing = false;
+  if (--c->in_use == 0)
+    cond_signal (&s->unpinned, &s->lock);
+  lock_release (&s->lock);
+}
+
+/* Takes C out of S's clock ring, stepping the hand back if it
+   points at C.  The caller must hold S's lock. */
+static void clock_remove (struct cache_shard *s, struct cache_entry *c){
+  if (s->hand == &c->c_elem)
+    s->hand = list_prev (&c->c_elem) != list_head (&s->ring)
+      ? list_prev (&c->c_elem) : NULL;
+  list_remove (&c->c_elem);
+}
+
+/* Advances clock hand E by one entry around S's ring, wrapping
+   from the back to the front. */
+static struct list_elem *clock_next (struct cache_shard *s,
+    struct list_elem *e){
+  if (e == NULL || e == list_back (&s->ring))
+    return list_begin (&s->ring);
+  return list_next (e);
+}
+
+static unsigned cache_hash_func (const struct hash_elem *e, void *aux UNUSED){
+  const struct cache_entry *c = hash_entry (e, struct cache_entry, h_elem);
+  return hash_int ((int) c->sector);
+}
+
+static bool cache_less_func (const struct hash_elem *a,
+    const struct hash_elem *b, void *aux UNUSED){
+  return hash_entry (a, struct cache_entry, h_elem)->sector
+    < hash_entry (b, struct cache_entry, h_elem)->sector;
+}
+
+/* The writeback thread.  Each period, syncs the free map, then
+   gathers the due entries of every shard into batches and starts
+   writing them, until none are left.  It does not wait for the
+   writes, so the disk's queue stays full, except to free the
+   sectors released by the time those entries were dirtied. */
 void write_back (void *aux UNUSED){
-  while (true)
-  {
-	timer_sleep (1000);
-	cache_destroy ();
-  }
-}
-/*
-void read_ahead (void *aux){
-  disk_sector_t ahead = * (disk_sector_t *)aux;
-  lock_acquire (&cache_lock);
-  struct cache_entry *c = cache_lookup (ahead);
-  if (c == NULL)
-	c = cache_evict_SC (ahead, false);
-  lock_release (&cache_lock);
-
-  free (aux);
-}
-*/
-void put_read_ahead (disk_sector_t ahead){
-  lock_acquire (&cache_lock);
-  struct ahead *a = malloc (sizeof *a);
-  if (list_empty (&aheads)){
-	a->sector = ahead;
-	list_push_back (&aheads, &a->e);
-	cond_signal (&empty, &cache_lock);
-  }else{
-	a->sector = ahead;
-	list_push_back (&aheads, &a->e);
-  }
-  lock_release (&cache_lock);
-}
-
-  
-
-void read_ahead (disk_sector_t ahead){
-  while(true){
-  struct list_elem *temp;
-  lock_acquire (&cache_lock);
-  if (list_empty (&aheads)){
-	lock_release (&cache_lock);
-	//continue;
-	cond_wait (&empty, &cache_lock);
-  }
-
-  temp = list_begin (&aheads);
-  lock_release (&cache_lock);
-  //lllldjdjdjdjdkdkdkdkdkdk
-  lock_acquire (&cache_lock);
-  struct ahead *ahead = list_entry (temp, struct ahead, e);
-  struct cache_entry *c = cache_lookup (ahead);
-  //lul
-  if (c == NULL)
-	c = cache_evict_SC (c->sector, false);
-
-  list_remove (temp);
-  free (ahead);
-  lock_release (&cache_lock);
-  /*
-  disk_sector_t *temp = calloc (1, sizeof *temp);
-  if (temp){
-	*temp = ahead+1;
-	thread_create ("read",0, read_ahead, temp);
-  }
-  can_read_ahead = true;
-  */
+  struct flush_batch b;
+
+  while (true){
+    int64_t expired;
+    int i;
+
+    timer_sleep (WRITE_BEHIND_PERIOD);
+    /* The free map goes first, so that nothing written below can
+       refer to a sector the map on disk still calls free. */
+    free_map_sync ();
+    expired = timer_ticks () - DIRTY_EXPIRE;
+    do {
+      b.cnt = 0;
+      for (i = 0; i < CACHE_SHARDS; i++)
+        flush_pick_due (&shards[i], expired, &b);
+      flush_extend (&b);
+      flush_write (&b);
+    } while (b.cnt > 0);
+
+    /* Everything dirtied by EXPIRED is on its way to disk now, so
+       committing the releases made by then writes little more. */
+    free_map_commit (expired);
+  }
+}
+
+/* Asks the readahead thread to bring SECTOR into the cache.
+   Does nothing if SECTOR is already cached or queued, or if the
+   queue is full. */
+void cache_read_ahead (disk_sector_t sector){
+  struct cache_shard *s = shard_of (sector);
+  bool cached;
+  size_t i;
+
+  lock_acquire (&s->lock);
+  cached = cache_lookup (s, sector) != NULL;
+  lock_release (&s->lock);
+  if (cached)
+    return;
+
+  lock_acquire (&ahead_lock);
+  if (ahead_cnt < READ_AHEAD_QUEUE){
+    for (i = 0; i < ahead_cnt; i++)
+      if (ahead_queue[(ahead_head + i) % READ_AHEAD_QUEUE] == sector)
+        break;
+    if (i == ahead_cnt){
+      ahead_queue[(ahead_head + ahead_cnt++) % READ_AHEAD_QUEUE] = sector;
+      cond_signal (&ahead_ready, &ahead_lock);
+    }
+  }
+  lock_release (&ahead_lock);
+}
+
+/* Loads queued sectors into the cache, oldest first, taking
+   queued runs of consecutive sectors together so that each is
+   read with one disk command.  A sector that was read in by
+   someone else in the meantime is a plain cache hit here. */
+static void read_ahead (void *aux UNUSED){
+  while (true){
+    disk_sector_t sector;
+    size_t cnt = 0;
+
+    lock_acquire (&ahead_lock);
+    while (ahead_cnt == 0)
+      cond_wait (&ahead_ready, &ahead_lock);
+    sector = ahead_queue[ahead_head];
+    do {
+      ahead_head = (ahead_head + 1) % READ_AHEAD_QUEUE;
+      ahead_cnt--;
+      cnt++;
+    } while (ahead_cnt > 0 && cnt < CACHE_SHARDS
+        && ahead_queue[ahead_head] == sector + cnt);
+    lock_release (&ahead_lock);
+
+    cache_load (sector, cnt);
   }
 }
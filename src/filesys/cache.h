@@ -1,48 +1,54 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
-#include "devices/disk.h"
+#include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/off_t.h"
 #include <list.h>
+#include <hash.h>
 #include "threads/synch.h"
+
+/* Default and minimum size of the cache, in sectors. */
 #define BUFFER_SIZE 64
 
-struct list cache;
-struct lock cache_lock;
-uint32_t cache_size;
+/* The cache is split into CACHE_SHARDS independently locked
+   shards; sector S lives in shard S % CACHE_SHARDS. */
+#define CACHE_SHARDS 8
+
+/* Target size of the cache in sectors, set by -cache. */
+extern size_t cache_max_sectors;
 
 struct cache_entry {
   disk_sector_t sector;
-//  struct lock sector_lock;
-  uint8_t buf[DISK_SECTOR_SIZE];
-  bool empty;
+  struct rwlock sector_lock;    /* Guards buf and dirty. */
+  uint8_t *buf;                 /* DISK_SECTOR_SIZE bytes in a cache page. */
   bool dirty;
-  int in_use;
+  int in_use;                   /* Pin count, under the shard lock. */
   bool access;
-  struct list_elem c_elem;
+  bool flushing;                /* In some flusher's batch. */
+  bool cached;                  /* Holds a sector and is in the index. */
+  bool queued;                  /* On the shard's dirty list. */
+  int64_t dirtied;              /* Tick at which it was queued. */
+  struct hash_elem h_elem;      /* Element in the sector index. */
+  struct list_elem c_elem;      /* Element in the clock ring or free list. */
+  struct list_elem d_elem;      /* Element in the shard's dirty list. */
 };
 
 void cache_init (void);
+size_t cache_shrink (size_t page_cnt);
 void cache_bye (void);
-void cache_destroy (void);
-
-struct cache_entry *cache_lookup (disk_sector_t sector);
-struct cache_entry *cache_return (disk_sector_t sector, bool write);
-struct cache_entry *cache_evict_SC (disk_sector_t sector, bool write);
+void cache_flush_all (void);
+void cache_flush_before (int64_t before);
+void cache_flush (disk_sector_t sector);
 
-void write_back (void * UNUSED);
-/*
-struct cache_entry *cache_lookup (disk_sector_t sector);
 struct cache_entry *cache_return (disk_sector_t sector, bool write);
+void cache_release (struct cache_entry *, bool dirty);
 
-//struct cache_entry *cache_evict_SC (disk_sector_t sector, bool write);
-struct cache_entry *cache_evict_SC (void);
-
-void cache_add (struct cache_entry *, disk_sector_t, bool);
-void cache_clear (struct cache_entry *, bool);
+void cache_read (disk_sector_t sector, void *buffer, off_t ofs, size_t size);
+void cache_write (disk_sector_t sector, const void *buffer, off_t ofs,
+    size_t size);
+void cache_read_ahead (disk_sector_t sector);
+void cache_load (disk_sector_t sector, size_t cnt);
 
-void cache_read (disk_sector_t sector, void *addr);
-
-void cache_write (disk_sector_t sector, void *addr);
-*/
+void write_back (void * UNUSED);
 #endif
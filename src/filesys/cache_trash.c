@@ -111,13 +111,13 @@ void cache_add (struct cache_entry *e, disk_sector_t sector, bool write){
   e->empty = false;
   e->dirty = write;
   e->access = true;
-  disk_read (filesys_disk, e->disk_sector, e->buf);
+  block_read (filesys_disk, e->disk_sector, e->buf);
 }
 
 void cache_clear (struct cache_entry *victim, bool delete){
   if (victim->dirty){
 	//printf("save dirty...\n");
-	disk_write (filesys_disk, victim->disk_sector, &victim->buf);
+	block_write (filesys_disk, victim->disk_sector, &victim->buf);
 	victim->dirty = false;
   }
   //victim->disk_sector = NULL;
@@ -128,11 +128,11 @@ void cache_clear (struct cache_entry *victim, bool delete){
   //sdfsd
 }
 void cache_read (disk_sector_t sector, void *addr){
-  disk_read (filesys_disk, sector, addr);
+  block_read (filesys_disk, sector, addr);
 }
 
 void cache_write (disk_sector_t sector, void *addr){
-  disk_read (filesys_disk, sector, addr);
+  block_read (filesys_disk, sector, addr);
 }
 
 
@@ -0,0 +1,176 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Dentry cache.
+
+   Maps a (directory sector, name) pair to the sector of the inode
+   that the directory holds under that name, or to DCACHE_NEGATIVE
+   if it holds none, so that path walks can skip the directory
+   scan.  dir_add() and dir_remove() keep it in step with the
+   directories on disk.
+
+   A lookup that misses takes a stamp, scans the directory, then
+   inserts what it found with the stamp.  Every invalidation bumps
+   the current stamp, so a result that may have been overtaken by
+   a concurrent add or remove is dropped instead of cached. */
+
+/* Maximum number of cached names. */
+#define DCACHE_SIZE 512
+
+struct dentry
+  {
+    disk_sector_t parent;               /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within the directory. */
+    disk_sector_t sector;               /* Inode sector or DCACHE_NEGATIVE. */
+    struct hash_elem h_elem;            /* Element in dentries. */
+    struct list_elem l_elem;            /* Element in lru. */
+  };
+
+static struct hash dentries;            /* All cached names. */
+static struct list lru;                 /* Most recently used first. */
+static struct lock dcache_lock;         /* Guards everything above. */
+static unsigned dcache_stamp;           /* Bumped by every invalidation. */
+
+static unsigned dentry_hash (const struct hash_elem *, void *aux);
+static bool dentry_less (const struct hash_elem *, const struct hash_elem *,
+                         void *aux);
+static struct dentry *find (disk_sector_t parent, const char *name);
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in the directory whose inode is in sector PARENT.
+   On a hit, returns true and sets *SECTORP to the inode sector,
+   or to DCACHE_NEGATIVE if the directory has no such name.  On a
+   miss, returns false and sets *STAMPP to the stamp to pass to
+   dcache_insert() after scanning the directory. */
+bool
+dcache_lookup (disk_sector_t parent, const char *name,
+               disk_sector_t *sectorp, unsigned *stampp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (parent, name);
+  if (d != NULL)
+    {
+      list_remove (&d->l_elem);
+      list_push_front (&lru, &d->l_elem);
+      *sectorp = d->sector;
+    }
+  else
+    *stampp = dcache_stamp;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that the directory in sector PARENT maps NAME to
+   SECTOR, which may be DCACHE_NEGATIVE.  Does nothing if any
+   entry has been invalidated since dcache_lookup() returned
+   STAMP. */
+void
+dcache_insert (disk_sector_t parent, const char *name, disk_sector_t sector,
+               unsigned stamp)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  if (stamp != dcache_stamp || find (parent, name) != NULL)
+    goto done;
+
+  /* Recycle the least recently used entry once the cache is
+     full. */
+  if (hash_size (&dentries) >= DCACHE_SIZE)
+    {
+      d = list_entry (list_pop_back (&lru), struct dentry, l_elem);
+      hash_delete (&dentries, &d->h_elem);
+    }
+  else
+    {
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        goto done;
+    }
+
+  d->parent = parent;
+  strlcpy (d->name, name, sizeof d->name);
+  d->sector = sector;
+  hash_insert (&dentries, &d->h_elem);
+  list_push_front (&lru, &d->l_elem);
+
+ done:
+  lock_release (&dcache_lock);
+}
+
+/* Forgets what is known about NAME in the directory in sector
+   PARENT.  Called whenever the directory gains or loses NAME. */
+void
+dcache_invalidate (disk_sector_t parent, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  dcache_stamp++;
+  d = find (parent, name);
+  if (d != NULL)
+    {
+      hash_delete (&dentries, &d->h_elem);
+      list_remove (&d->l_elem);
+      free (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the cached entry for NAME in PARENT, or a null pointer.
+   The caller must hold dcache_lock. */
+static struct dentry *
+find (disk_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.h_elem);
+  return e != NULL ? hash_entry (e, struct dentry, h_elem) : NULL;
+}
+
+/* Returns a hash of the directory and name of dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, h_elem);
+
+  return hash_int (d->parent) ^ hash_string (d->name);
+}
+
+/* Orders dentries A and B by directory, then by name. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, h_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, h_elem);
+
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
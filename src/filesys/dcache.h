@@ -0,0 +1,17 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/* Sector recorded for a name known to be absent. */
+#define DCACHE_NEGATIVE ((disk_sector_t) -1)
+
+void dcache_init (void);
+bool dcache_lookup (disk_sector_t parent, const char *name,
+                    disk_sector_t *sectorp, unsigned *stampp);
+void dcache_insert (disk_sector_t parent, const char *name,
+                    disk_sector_t sector, unsigned stamp);
+void dcache_invalidate (disk_sector_t parent, const char *name);
+
+#endif /* filesys/dcache.h */
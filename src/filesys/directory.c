@@ -1,7 +1,11 @@
 #include "filesys/directory.h"
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -58,55 +62,42 @@ dir_open_root (void)
   return dir_open (inode_open (ROOT_DIR_SECTOR));
 }
 
+/* Opens the directory named by PATH, relative to the current
+   directory unless it starts with "/".  Only the last directory
+   gets a struct dir; the walk holds just the inode of the
+   directory it is in. */
 struct dir *
 dir_open_path (const char *path){
   int len = strlen (path);
   char s[len+1];
-  strlcpy (s, path, len+1);
+  struct inode *inode;
+  char *token, *save;
 
-//  struct dir *d = dir_open_root ();
-  struct dir *d;
-  if (path[0] == '/')
-	d = dir_open_root ();
-  else{
-	//printf("...%s\n", path);
-	if (thread_current ()->cwd == NULL){
-	  //printf("nonsense\n");
-	  d = dir_open_root ();
-  	}else{
-	  d = dir_reopen (thread_current ()->cwd);
-  }
-  }
+  strlcpy (s, path, len+1);
+  if (path[0] == '/' || thread_current ()->cwd == NULL)
+	inode = inode_open (ROOT_DIR_SECTOR);
+  else
+	inode = inode_reopen (dir_get_inode (thread_current ()->cwd));
 
-  char *token, *save;
   for (token = strtok_r (s, "/", &save);
-	  token != NULL;
+	  token != NULL && inode != NULL;
 	  token = strtok_r (NULL, "/", &save)){
-	//printf("here?\n");
-	if (strcmp (token, ".") ==0){
-	  continue;
-	}
-	struct inode *inode = NULL;
-	if (strcmp(token, "..") == 0){
-	  if (!get_parent (d, &inode))
-		return NULL;
-	//  printf("okay\n");
-	  //printf("yeah\n");
-	  //continue;
-	}else if (!dir_lookup (d, token, &inode)){
-	  dir_close (d);
-	  return NULL;
-	}
+	struct dir d;
+	struct inode *next;
 
-	struct dir *temp = dir_open (inode);
-	if (temp == NULL){
-	  dir_close (d);
-	  return NULL;
+	if (strcmp (token, ".") ==0)
+	  continue;
+	if (strcmp (token, "..") == 0)
+	  next = inode_open (get_parent_sector (inode));
+	else{
+	  d.inode = inode;
+	  d.pos = 0;
+	  dir_lookup (&d, token, &next);
 	}
-	dir_close(d);
-	d = temp;
+	inode_close (inode);
+	inode = next;
   }
-  return d;
+  return dir_open (inode);
 }
 
 /* Opens and returns a new directory for the same inode as DIR.
@@ -135,37 +126,507 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
+/* Hashed directories.
+
+   A linear directory that fills up with DIR_INDEX_MIN or more
+   entries is rewritten as a linear hash table keyed on the name
+   hash.  Sector 0 of the directory then holds a struct dir_index
+   whose first bytes look like a free dir_entry carrying
+   DIR_INDEX_MAGIC, which is how the two layouts are told apart.
+   Every other sector is a struct dir_block: the primary block of
+   a bucket or one of its overflow blocks, chained through NEXT.
+
+   The table grows one bucket at a time.  Once the load passes
+   3/4, bucket SPLIT is split into SPLIT and SPLIT + 2**LEVEL, so
+   no insertion rehashes more than a single bucket.  If a split
+   fails, say because the disk is full, SPLIT_HOLD puts off the
+   next try until another block's worth of entries has been
+   added, instead of retrying on every insertion. */
+
+/* Marks sector 0 of a hashed directory.  Larger than any sector
+   number, so no real entry carries it. */
+#define DIR_INDEX_MAGIC 0x48534944
+
+/* Number of entries a linear directory must hold before it is
+   converted to the hashed layout. */
+#define DIR_INDEX_MIN (2 * DIR_BLOCK_ENTRIES)
+
+/* Entries in one sector of a hashed directory. */
+#define DIR_BLOCK_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* One sector of a hashed directory. */
+struct dir_block
+  {
+    struct dir_entry entries[DIR_BLOCK_ENTRIES];
+    uint32_t next;                      /* Next block in chain, or 0. */
+  };
+
+/* Number of buckets the index can address. */
+#define DIR_MAX_BUCKETS 112
+
+/* Sector 0 of a hashed directory. */
+struct dir_index
+  {
+    struct dir_entry marker;            /* Free, sector DIR_INDEX_MAGIC. */
+    uint32_t level;                     /* 2**LEVEL buckets per round. */
+    uint32_t split;                     /* Next bucket to split. */
+    uint32_t block_cnt;                 /* Blocks in use, with sector 0. */
+    uint32_t free_block;                /* Head of free block list, or 0. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+    uint32_t split_hold;                /* No split below this many. */
+    uint32_t bucket[DIR_MAX_BUCKETS];   /* First block of each bucket. */
+  };
+
+/* Scratch space for one directory operation. */
+struct dir_scratch
+  {
+    struct dir_index idx;
+    struct dir_block blk;
+  };
+
+/* Returns the byte offset of block BLOCK. */
+static off_t
+block_ofs (uint32_t block)
+{
+  return (off_t) block * DISK_SECTOR_SIZE;
+}
+
+/* Returns the number of buckets in IDX. */
+static uint32_t
+bucket_cnt (const struct dir_index *idx)
+{
+  return (1u << idx->level) + idx->split;
+}
+
+/* Returns the bucket that holds NAME. */
+static uint32_t
+name_bucket (const struct dir_index *idx, const char *name)
+{
+  unsigned hash = hash_string (name);
+  uint32_t bucket = hash & ((1u << idx->level) - 1);
+
+  if (bucket < idx->split)
+    bucket = hash & ((2u << idx->level) - 1);
+  return bucket;
+}
+
+/* Reads sector 0 of INODE into IDX.  Returns true if INODE is a
+   hashed directory, false if it is linear. */
+static bool
+read_index (struct inode *inode, struct dir_index *idx)
+{
+  return (inode_read_at (inode, idx, sizeof *idx, 0) == sizeof *idx
+          && !idx->marker.in_use
+          && idx->marker.inode_sector == DIR_INDEX_MAGIC);
+}
+
+static bool
+write_index (struct inode *inode, const struct dir_index *idx)
+{
+  return inode_write_at (inode, idx, sizeof *idx, 0) == sizeof *idx;
+}
+
+static bool
+read_block (struct inode *inode, uint32_t block, struct dir_block *b)
+{
+  return inode_read_at (inode, b, sizeof *b, block_ofs (block)) == sizeof *b;
+}
+
+static bool
+write_block (struct inode *inode, uint32_t block, const struct dir_block *b)
+{
+  return inode_write_at (inode, b, sizeof *b, block_ofs (block)) == sizeof *b;
+}
+
+/* Reads the chain link of block BLOCK. */
+static uint32_t
+block_next (struct inode *inode, uint32_t block)
+{
+  uint32_t next = 0;
+
+  inode_read_at (inode, &next, sizeof next,
+                 block_ofs (block) + offsetof (struct dir_block, next));
+  return next;
+}
+
+/* Takes a block off IDX's free list, or appends one to the
+   directory if the list is empty. */
+static uint32_t
+alloc_block (struct inode *inode, struct dir_index *idx)
+{
+  uint32_t block = idx->free_block;
+
+  if (block == 0)
+    return idx->block_cnt++;
+  idx->free_block = block_next (inode, block);
+  return block;
+}
+
+/* Clears block BLOCK and puts it on IDX's free list. */
+static bool
+release_block (struct inode *inode, struct dir_index *idx, uint32_t block,
+               struct dir_block *b)
+{
+  memset (b, 0, sizeof *b);
+  b->next = idx->free_block;
+  idx->free_block = block;
+  return write_block (inode, block, b);
+}
+
+/* Returns the number of blocks in a chain of CNT entries. */
+static size_t
+chain_blocks (size_t cnt)
+{
+  return cnt > 0 ? DIV_ROUND_UP (cnt, DIR_BLOCK_ENTRIES) : 1;
+}
+
+/* Takes CNT blocks for new chains into POOL, from IDX's free list
+   first and then past the end of the directory.  The new blocks
+   at the end are written out at once, so that the directory has
+   grown to hold them before anything is written over.  On
+   failure, leaves IDX as it was and returns false. */
+static bool
+reserve_blocks (struct inode *inode, struct dir_index *idx, uint32_t *pool,
+                size_t cnt, struct dir_block *b)
+{
+  uint32_t block_cnt = idx->block_cnt;
+  uint32_t free_block = idx->free_block;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    pool[i] = alloc_block (inode, idx);
+  memset (b, 0, sizeof *b);
+  for (i = 0; i < cnt; i++)
+    if (pool[i] >= block_cnt && !write_block (inode, pool[i], b))
+      {
+        idx->block_cnt = block_cnt;
+        idx->free_block = free_block;
+        return false;
+      }
+  return true;
+}
+
+/* Writes the CNT entries in ENTRIES as a new chain and returns its
+   first block, or 0 on failure.  Blocks come from POOL[*USED]
+   onward, advancing *USED; POOL_CNT must leave room for
+   chain_blocks (CNT) of them.  The chain always has at least one
+   block. */
+static uint32_t
+write_chain (struct inode *inode, const struct dir_entry *entries, size_t cnt,
+             const uint32_t *pool, size_t pool_cnt, size_t *used,
+             struct dir_block *b)
+{
+  uint32_t block, head;
+  size_t ofs;
+
+  ASSERT (*used + chain_blocks (cnt) <= pool_cnt);
+  block = head = pool[(*used)++];
+  for (ofs = 0; ; ofs += DIR_BLOCK_ENTRIES)
+    {
+      size_t n = cnt - ofs < DIR_BLOCK_ENTRIES ? cnt - ofs : DIR_BLOCK_ENTRIES;
+
+      memset (b, 0, sizeof *b);
+      memcpy (b->entries, entries + ofs, n * sizeof *entries);
+      if (ofs + n < cnt)
+        b->next = pool[(*used)++];
+      if (!write_block (inode, block, b))
+        return 0;
+      if (b->next == 0)
+        return head;
+      block = b->next;
+    }
+}
+
+/* Searches the hashed directory INODE, whose index is IDX, for
+   NAME, as lookup() does.  If NAME is absent and FREEP is
+   non-null, sets *FREEP to the offset of a free slot in NAME's
+   bucket, or to -1 if the bucket is full, in which case *LASTP is
+   set to the bucket's last block. */
+static bool
+hashed_lookup (struct inode *inode, const struct dir_index *idx,
+               const char *name, struct dir_entry *ep, off_t *ofsp,
+               off_t *freep, uint32_t *lastp, struct dir_block *b)
+{
+  uint32_t block = idx->bucket[name_bucket (idx, name)];
+  off_t free_ofs = -1;
+
+  for (;;)
+    {
+      size_t i;
+
+      if (!read_block (inode, block, b))
+        return false;
+      for (i = 0; i < DIR_BLOCK_ENTRIES; i++)
+        {
+          struct dir_entry *e = &b->entries[i];
+          off_t ofs = block_ofs (block) + i * sizeof *e;
+
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+          if (!e->in_use && free_ofs < 0)
+            free_ofs = ofs;
+        }
+      if (b->next == 0)
+        break;
+      block = b->next;
+    }
+
+  if (freep != NULL)
+    {
+      *freep = free_ofs;
+      *lastp = block;
+    }
+  return false;
+}
+
+/* Splits the next bucket of the hashed directory INODE, moving
+   the entries that now hash past it into a new bucket.  Both
+   buckets are written to fresh blocks, and IDX switches over to
+   them only once they are complete, so a failure leaves the old
+   bucket as it was. */
+static bool
+hashed_split (struct inode *inode, struct dir_index *idx, struct dir_block *b)
+{
+  uint32_t old = idx->split;
+  uint32_t mask = (2u << idx->level) - 1;
+  uint32_t *blocks, *pool = NULL, block, first, second;
+  struct dir_entry *entries;
+  size_t block_cnt, cnt, keep, need, used, i;
+  bool success = false;
+
+  /* Read the whole chain of the bucket being split. */
+  block_cnt = 1;
+  for (block = idx->bucket[old]; (block = block_next (inode, block)) != 0; )
+    block_cnt++;
+  blocks = malloc (block_cnt * sizeof *blocks);
+  entries = malloc (block_cnt * sizeof b->entries);
+  if (blocks == NULL || entries == NULL)
+    goto done;
+
+  cnt = 0;
+  block = idx->bucket[old];
+  for (i = 0; i < block_cnt; i++)
+    {
+      size_t j;
+
+      if (!read_block (inode, block, b))
+        goto done;
+      blocks[i] = block;
+      for (j = 0; j < DIR_BLOCK_ENTRIES; j++)
+        if (b->entries[j].in_use)
+          entries[cnt++] = b->entries[j];
+      block = b->next;
+    }
+
+  /* Entries that stay go first, entries that move go last. */
+  keep = 0;
+  for (i = 0; i < cnt; i++)
+    if ((hash_string (entries[i].name) & mask) == old)
+      {
+        struct dir_entry e = entries[i];
+        entries[i] = entries[keep];
+        entries[keep++] = e;
+      }
+
+  /* Write both buckets. */
+  need = chain_blocks (keep) + chain_blocks (cnt - keep);
+  pool = malloc (need * sizeof *pool);
+  if (pool == NULL || !reserve_blocks (inode, idx, pool, need, b))
+    goto done;
+  used = 0;
+  first = write_chain (inode, entries, keep, pool, need, &used, b);
+  second = write_chain (inode, entries + keep, cnt - keep, pool, need,
+                        &used, b);
+  if (first == 0 || second == 0)
+    {
+      for (i = 0; i < need; i++)
+        release_block (inode, idx, pool[i], b);
+      goto done;
+    }
+
+  /* Switch over, then free the old chain.  A block that cannot be
+     freed is only lost. */
+  idx->bucket[old] = first;
+  idx->bucket[old + (1u << idx->level)] = second;
+  if (++idx->split == 1u << idx->level)
+    {
+      idx->level++;
+      idx->split = 0;
+    }
+  for (i = 0; i < block_cnt; i++)
+    release_block (inode, idx, blocks[i], b);
+  success = true;
+
+ done:
+  free (pool);
+  free (entries);
+  free (blocks);
+  return success;
+}
+
+/* Converts the linear directory INODE to the hashed layout,
+   leaving its new index in IDX.  The buckets are written past the
+   end of the linear entries, and the index over them in sector 0
+   last, so a failure leaves the directory linear and intact.  The
+   sectors that held the linear entries then become free blocks. */
+static bool
+make_index (struct inode *inode, struct dir_index *idx, struct dir_block *b)
+{
+  off_t length = inode_length (inode);
+  uint32_t old_blocks = DIV_ROUND_UP (length, DISK_SECTOR_SIZE);
+  struct dir_entry *entries, *bucket;
+  uint32_t *pool = NULL;
+  size_t cnt, need, used, i, n;
+  bool success = false;
+
+  entries = malloc (length);
+  bucket = malloc (length);
+  if (entries == NULL || bucket == NULL
+      || inode_read_at (inode, entries, length, 0) != length)
+    goto done;
+  for (cnt = i = 0; i < length / sizeof *entries; i++)
+    if (entries[i].in_use)
+      entries[cnt++] = entries[i];
+
+  memset (idx, 0, sizeof *idx);
+  idx->marker.inode_sector = DIR_INDEX_MAGIC;
+  idx->level = 2;
+  while ((2u << idx->level) <= DIR_MAX_BUCKETS
+         && (1u << idx->level) * DIR_BLOCK_ENTRIES * 3 < cnt * 4)
+    idx->level++;
+  idx->block_cnt = old_blocks;
+  idx->entry_cnt = cnt;
+
+  /* Write the buckets. */
+  need = 0;
+  for (i = 0; i < bucket_cnt (idx); i++)
+    {
+      size_t j;
+
+      for (n = j = 0; j < cnt; j++)
+        if (name_bucket (idx, entries[j].name) == i)
+          n++;
+      need += chain_blocks (n);
+    }
+  pool = malloc (need * sizeof *pool);
+  if (pool == NULL || !reserve_blocks (inode, idx, pool, need, b))
+    goto done;
+  used = 0;
+  for (i = 0; i < bucket_cnt (idx); i++)
+    {
+      size_t j;
+
+      for (n = j = 0; j < cnt; j++)
+        if (name_bucket (idx, entries[j].name) == i)
+          bucket[n++] = entries[j];
+      idx->bucket[i] = write_chain (inode, bucket, n, pool, need, &used, b);
+      if (idx->bucket[i] == 0)
+        goto done;
+    }
+
+  /* Switch over, then free the old sectors. */
+  if (!write_index (inode, idx))
+    goto done;
+  for (i = 1; i < old_blocks; i++)
+    release_block (inode, idx, i, b);
+  success = write_index (inode, idx);
+
+ done:
+  free (pool);
+  free (bucket);
+  free (entries);
+  return success;
+}
+
+/* Searches the linear directory INODE for NAME, as lookup() does,
+   reading a block's worth of entries at a time.  If NAME is absent
+   and FREEP is non-null, sets *FREEP to the offset of the first
+   free slot, or to the end of the directory if there is none, and
+   *CNTP to the number of entries in use. */
+static bool
+linear_lookup (struct inode *inode, const char *name, struct dir_entry *ep,
+               off_t *ofsp, off_t *freep, size_t *cntp, struct dir_block *b)
+{
+  off_t ofs = 0, free_ofs = -1;
+  size_t cnt = 0;
+
+  for (;;)
+    {
+      off_t bytes = inode_read_at (inode, b->entries, sizeof b->entries, ofs);
+      size_t i, n = bytes / sizeof *b->entries;
+
+      for (i = 0; i < n; i++, ofs += sizeof *b->entries)
+        {
+          struct dir_entry *e = &b->entries[i];
+
+          if (!e->in_use)
+            {
+              if (free_ofs < 0)
+                free_ofs = ofs;
+            }
+          else if (!strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+          else
+            cnt++;
+        }
+      if (n < DIR_BLOCK_ENTRIES)
+        break;
+    }
+
+  if (freep != NULL)
+    {
+      *freep = free_ofs >= 0 ? free_ofs : ofs;
+      *cntp = cnt;
+    }
+  return false;
+}
+
+/* Searches DIR for a file with the given NAME, using S as scratch
+   space.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+scan (const struct dir *dir, const char *name,
+      struct dir_entry *ep, off_t *ofsp, struct dir_scratch *s) 
 {
-  struct dir_entry e;
-  size_t ofs;
-  
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) {
-	
-		if (e.in_use && !strcmp (name, e.name)) 
-      {
-       
-		//if (strcmp (name, "dir21")==0)
-		//  printf("dir21: e.name[%s]\n",e.name); 
-		if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-		return true;
-      }
-  }
-  return false;
+  if (read_index (dir->inode, &s->idx))
+    return hashed_lookup (dir->inode, &s->idx, name, ep, ofsp,
+                          NULL, NULL, &s->blk);
+  else
+    return linear_lookup (dir->inode, name, ep, ofsp, NULL, NULL, &s->blk);
+}
+
+/* Searches DIR for a file with the given NAME, as scan() does.
+   Also returns false if memory runs out. */
+static bool
+lookup (const struct dir *dir, const char *name,
+        struct dir_entry *ep, off_t *ofsp) 
+{
+  struct dir_scratch *s = malloc (sizeof *s);
+  bool found;
+
+  if (s == NULL)
+    return false;
+  found = scan (dir, name, ep, ofsp, s);
+  free (s);
+  return found;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -176,16 +637,35 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  disk_sector_t parent, sector;
+  unsigned stamp;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  /* On a dentry cache miss, scan the directory and cache the
+     result, absent names included.  The inode is opened under the
+     directory lock, so that it cannot be removed in between. */
+  parent = inode_get_inumber (dir->inode);
+  *inode = NULL;
+  inode_lock (dir->inode);
+  if (!dcache_lookup (parent, name, &sector, &stamp))
+    {
+      struct dir_scratch *s = malloc (sizeof *s);
+      struct dir_entry e;
 
+      if (s == NULL)
+        goto done;
+      sector = scan (dir, name, &e, NULL, s) ? e.inode_sector : DCACHE_NEGATIVE;
+      dcache_insert (parent, name, sector, stamp);
+      free (s);
+    }
+
+  if (sector != DCACHE_NEGATIVE)
+    *inode = inode_open (sector);
+
+ done:
+  inode_unlock (dir->inode);
   return *inode != NULL;
 }
 
@@ -198,45 +678,98 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) 
 {
+  struct dir_scratch *s = NULL;
   struct dir_entry e;
-  off_t ofs;
-  bool success = false;
+  off_t ofs = -1;
+  uint32_t last = 0;
+  size_t cnt = 0;
+  bool hashed, success = false;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
-  //printf("adding %s\n", name);
 
   /* Check NAME for validity. */
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL)){
-	//printf("noname\n");
+  s = malloc (sizeof *s);
+  if (s == NULL)
+    return false;
+
+  /* A removed directory takes no new entries. */
+  inode_lock (dir->inode);
+  if (inode_is_removed (dir->inode))
     goto done;
-}
-  if (!add_parent (inode_get_inumber (dir_get_inode (dir)), inode_sector))
-	goto done;
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+
+  /* Check that NAME is not in use, finding a free slot on the
+     way.  In a linear directory, OFS is set to the current
+     end-of-file if there are no free slots.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  hashed = read_index (dir->inode, &s->idx);
+  if (hashed ? hashed_lookup (dir->inode, &s->idx, name, NULL, NULL,
+                              &ofs, &last, &s->blk)
+      : linear_lookup (dir->inode, name, NULL, NULL, &ofs, &cnt, &s->blk))
+    goto done;
+  if (!add_parent (inode_get_inumber (dir_get_inode (dir)), inode_sector))
+	goto done;
+
+  /* A full linear directory that has grown large is hashed
+     before it grows any further. */
+  if (!hashed && cnt >= DIR_INDEX_MIN && ofs >= inode_length (dir->inode))
+    {
+      if (!make_index (dir->inode, &s->idx, &s->blk))
+        goto done;
+      hashed = true;
+      hashed_lookup (dir->inode, &s->idx, name, NULL, NULL,
+                     &ofs, &last, &s->blk);
+    }
 
   /* Write slot. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (!hashed)
+    {
+      success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+      if (success)
+        dcache_invalidate (inode_get_inumber (dir->inode), name);
+      goto done;
+    }
+
+  if (ofs >= 0)
+    success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  else if (last != 0)
+    {
+      /* The bucket is full: chain a new block onto it. */
+      uint32_t block = alloc_block (dir->inode, &s->idx);
+
+      memset (&s->blk, 0, sizeof s->blk);
+      s->blk.entries[0] = e;
+      success = (write_block (dir->inode, block, &s->blk)
+                 && inode_write_at (dir->inode, &block, sizeof block,
+                                    block_ofs (last)
+                                    + offsetof (struct dir_block, next))
+                    == sizeof block);
+    }
+  if (success)
+    {
+      dcache_invalidate (inode_get_inumber (dir->inode), name);
+      s->idx.entry_cnt++;
+      if (s->idx.entry_cnt * 4 > bucket_cnt (&s->idx) * DIR_BLOCK_ENTRIES * 3
+          && bucket_cnt (&s->idx) < DIR_MAX_BUCKETS
+          && s->idx.entry_cnt >= s->idx.split_hold
+          && !hashed_split (dir->inode, &s->idx, &s->blk))
+        s->idx.split_hold = s->idx.entry_cnt + DIR_BLOCK_ENTRIES;
+      success = write_index (dir->inode, &s->idx);
+    }
 
  done:
-  //printf("adding done%s | %d\n", name, success);
+  inode_unlock (dir->inode);
+  free (s);
   return success;
 }
 /*
@@ -251,9 +784,9 @@ bool add_parent (struct dir *dir, disk_sector_t child){
 
   struct inode_disk *id = calloc (1, sizeof *id);
   
-  disk_read (filesys_disk, inode->parent, id);
+  block_read (filesys_disk, inode->parent, id);
   id->parent = parent;
-  disk_write (filesys_disk, inode->parent, id);
+  block_write (filesys_disk, inode->parent, id);
   free (id);
   inode_close (inode);
   return true;
@@ -265,13 +798,15 @@ bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
+  struct dir_index *idx;
   struct inode *inode = NULL;
-  bool success = false;
+  bool locked = false, success = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock (dir->inode);
   //printf("removing %s \n", name);
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs)){
@@ -291,7 +826,12 @@ dir_remove (struct dir *dir, const char *name)
 	goto done;
   }
   
-  
+  /* A directory being removed is locked until it is marked
+     removed, so that nothing is added to it meanwhile. */
+  if (inode_is_dir (inode)){
+	inode_lock (inode);
+	locked = true;
+  }
   if (inode_is_dir (inode) && !dir_is_empty (inode)){
 	//printf("NONEMPTY..\n");
 	goto done;
@@ -304,6 +844,17 @@ dir_remove (struct dir *dir, const char *name)
     goto done;
   }
 
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+
+  /* Keep a hashed directory's entry count in step. */
+  idx = malloc (sizeof *idx);
+  if (idx != NULL && read_index (dir->inode, idx))
+    {
+      idx->entry_cnt--;
+      write_index (dir->inode, idx);
+    }
+  free (idx);
+
   //printf("....\n");
   /* Remove inode. */
   inode_remove (inode);
@@ -311,7 +862,10 @@ dir_remove (struct dir *dir, const char *name)
 
   //printf("????\n");
  done:
+  if (locked)
+	inode_unlock (inode);
   inode_close (inode);
+  inode_unlock (dir->inode);
   return success;
 }
 
@@ -321,18 +875,45 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_index *idx;
   struct dir_entry e;
+  off_t end = -1;
+  bool found = false;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /* In a hashed directory, walk the entries of every block after
+     the index, skipping each block's link field. */
+  idx = malloc (sizeof *idx);
+  if (idx == NULL)
+    return false;
+  inode_lock (dir->inode);
+  if (read_index (dir->inode, idx))
     {
+      end = block_ofs (idx->block_cnt);
+      if (dir->pos < DISK_SECTOR_SIZE)
+        dir->pos = DISK_SECTOR_SIZE;
+    }
+  free (idx);
+
+  while (end < 0 || dir->pos < end)
+    {
+      if (end >= 0 && dir->pos % DISK_SECTOR_SIZE
+                      == offsetof (struct dir_block, next))
+        {
+          dir->pos = ROUND_UP (dir->pos, DISK_SECTOR_SIZE);
+          continue;
+        }
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
+          found = true;
+          break;
         } 
     }
-  return false;
+  inode_unlock (dir->inode);
+  return found;
 }
 
 bool dir_is_root (struct dir *dir){
@@ -344,16 +925,31 @@ bool dir_is_root (struct dir *dir){
   return false;
 }
 
+/* Returns true if directory INODE has no entries.  The caller
+   must hold INODE's directory lock. */
 bool dir_is_empty (struct inode *inode){
-  struct dir_entry e;
-  size_t ofs;
+  struct dir_scratch *s = malloc (sizeof *s);
+  bool empty;
 
-  for (ofs = 0; inode_read_at (inode, &e, sizeof e, ofs) == sizeof e;
-	  ofs += sizeof e){
-	if (e.in_use)
-	  return false;
+  if (s == NULL)
+	return false;
+  if (read_index (inode, &s->idx))
+	empty = s->idx.entry_cnt == 0;
+  else{
+	off_t ofs = 0, bytes;
+	size_t i;
+
+	empty = true;
+	while (empty && (bytes = inode_read_at (inode, s->blk.entries,
+	                                        sizeof s->blk.entries, ofs)) > 0){
+	  for (i = 0; i < bytes / sizeof *s->blk.entries; i++)
+		if (s->blk.entries[i].in_use)
+		  empty = false;
+	  ofs += bytes;
+	}
   }
-  return true;
+  free (s);
+  return empty;
 }
 
 void get_filename (const char *path, char *filename){
@@ -3,7 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
-#include "devices/disk.h"
+#include "devices/block.h"
 
 /* Maximum length of a file name component.
    This is the traditional UNIX maximum length.
@@ -9,8 +9,19 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_end;               /* End of read-ahead already queued. */
+    off_t ra_window;            /* Bytes to keep queued ahead of pos. */
   };
 
+/* Bounds on the read-ahead window.  The window starts at the
+   minimum on the first sequential read, doubles on each one that
+   follows, and collapses to zero on a seek elsewhere. */
+#define READ_AHEAD_MIN (4 * DISK_SECTOR_SIZE)
+#define READ_AHEAD_MAX (32 * DISK_SECTOR_SIZE)
+
+static void file_read_ahead (struct file *, off_t size, off_t pos);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +34,9 @@ file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -70,10 +84,39 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, bytes_read, file->pos);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/* Updates FILE's read-ahead state after a read of SIZE bytes at
+   POS and, if the file is being read sequentially, queues the
+   part of the window beyond what was already queued. */
+static void
+file_read_ahead (struct file *file, off_t size, off_t pos)
+{
+  off_t start;
+
+  if (pos != file->ra_next)
+    {
+      file->ra_window = 0;
+      file->ra_end = pos + size;
+    }
+  else if (file->ra_window == 0)
+    file->ra_window = READ_AHEAD_MIN;
+  else if (file->ra_window < READ_AHEAD_MAX)
+    file->ra_window *= 2;
+  file->ra_next = pos + size;
+
+  start = file->ra_end > file->ra_next ? file->ra_end : file->ra_next;
+  if (start < file->ra_next + file->ra_window)
+    {
+      inode_read_ahead (file->inode, file->ra_next + file->ra_window - start,
+                        start);
+      file->ra_end = file->ra_next + file->ra_window;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -3,15 +3,16 @@
 #include <stdio.h>
 #include <string.h>
 #include "filesys/file.h"
+#include "filesys/dcache.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
-#include "devices/disk.h"
+#include "devices/block.h"
 #include "filesys/cache.h"
 #include "threads/thread.h"
 
-/* The disk that contains the file system. */
-struct disk *filesys_disk;
+/* The block device that contains the file system. */
+struct block *filesys_disk;
 
 static void do_format (void);
 
@@ -20,13 +21,14 @@ static void do_format (void);
 void
 filesys_init (bool format) 
 {
-  filesys_disk = disk_get (0, 1);
+  filesys_disk = block_get_role (BLOCK_FILESYS);
   if (filesys_disk == NULL)
-    PANIC ("hd0:1 (hdb) not present, file system initialization failed");
+    PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
   free_map_init ();
   cache_init ();
+  dcache_init ();
 
   if (format) 
     do_format ();
@@ -61,8 +63,10 @@ filesys_create (const char *name, off_t initial_size, bool is_dir)
 
   struct dir *dir = dir_open_path (path);
 
+  /* Place the new inode near its directory. */
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate (1, inode_get_inumber (dir_get_inode (dir)),
+                                        &inode_sector)
                   && inode_create (inode_sector, initial_size, is_dir)
                   && dir_add (dir, filename, inode_sector));
   /*
@@ -8,8 +8,8 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
-/* Disk used for file system. */
-extern struct disk *filesys_disk;
+/* Block device used for file system. */
+extern struct block *filesys_disk;
 
 void filesys_init (bool format);
 void filesys_done (void);
@@ -1,51 +1,353 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
 
+/* The free map is authoritative in memory.  Changes reach its
+   file only in write_dirty(), which writes just the sectors of the
+   file marked in free_map_dirty. */
+static struct bitmap *free_map_dirty;
+
+/* Bits of free_map stored in one sector of its file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
+/* The disk is divided into block groups of GROUP_SECTORS sectors,
+   one sector of the free map file each.  Allocation starts from a
+   goal sector and stays in the goal's group if it can, so that a
+   file's sectors, its inode and its directory end up close
+   together.  group_free[] counts the free sectors of each group,
+   letting a search skip the groups that are too full. */
+#define GROUP_SECTORS BITS_PER_SECTOR
+static size_t group_cnt;
+static size_t *group_free;
+
+/* A run of sectors released at tick RELEASED.  Released sectors
+   stay marked in use until free_map_commit() has seen every cache
+   block dirtied by then, including whatever stopped referring to
+   them, onto disk, so a crash cannot leave them both reused and
+   still referenced. */
+struct release
+  {
+    disk_sector_t sector;
+    size_t cnt;
+    int64_t released;
+    struct list_elem elem;
+  };
+static struct list releases;    /* Oldest first. */
+
+/* Guards free_map, free_map_dirty and releases. */
+static struct lock free_map_lock;
+
+static void mark_dirty (disk_sector_t, size_t cnt);
+static void count_groups (void);
+static void count_run (disk_sector_t, size_t cnt, bool used);
+static size_t scan_groups (size_t cnt, disk_sector_t goal);
+static bool commit_releases (void);
+static void write_dirty (void);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
-  free_map = bitmap_create (disk_size (filesys_disk));
+  free_map = bitmap_create (block_size (filesys_disk));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--disk is too large");
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                DISK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("group table creation failed--disk is too large");
+  list_init (&releases);
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  count_groups ();
 }
 
-/* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+/* Allocates CNT consecutive sectors from the free map, as close
+   after GOAL as possible, and stores the first into *SECTORP.
    Returns true if successful, false if all sectors were
    available. */
 bool
-free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
+free_map_allocate (size_t cnt, disk_sector_t goal, disk_sector_t *sectorp) 
 {
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  disk_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = scan_groups (cnt, goal);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      count_run (sector, cnt, true);
+      mark_dirty (sector, cnt);
     }
+  lock_release (&free_map_lock);
+
+  if (sector == BITMAP_ERROR && commit_releases ())
+    return free_map_allocate (cnt, goal, sectorp);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Allocates a run of up to CNT consecutive sectors, stores the
+   first into *SECTORP, and returns the run's length, or 0 if the
+   disk is full.  If GOAL is free, the run starts there and takes
+   as many of the following sectors as are free; otherwise the
+   longest of CNT, CNT / 2, CNT / 4, ... that fits is taken from
+   the first place it fits after GOAL, as free_map_allocate()
+   would. */
+size_t
+free_map_allocate_run (size_t cnt, disk_sector_t goal, disk_sector_t *sectorp)
+{
+  disk_sector_t sector = goal;
+  size_t run = 0;
+
+  lock_acquire (&free_map_lock);
+  while (run < cnt && goal + run < bitmap_size (free_map)
+         && !bitmap_test (free_map, goal + run))
+    run++;
+  if (run == 0)
+    for (run = cnt; run > 0; run /= 2)
+      {
+        sector = scan_groups (run, goal);
+        if (sector != BITMAP_ERROR)
+          break;
+      }
+  if (run > 0)
+    {
+      bitmap_set_multiple (free_map, sector, run, true);
+      count_run (sector, run, true);
+      mark_dirty (sector, run);
+    }
+  lock_release (&free_map_lock);
+
+  if (run == 0)
+    return commit_releases () ? free_map_allocate_run (cnt, goal, sectorp) : 0;
+  *sectorp = sector;
+  return run;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use, once
+   free_map_commit() gets to them. */
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
+  struct release *r = malloc (sizeof *r);
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  if (r != NULL && free_map_file != NULL)
+    {
+      r->sector = sector;
+      r->cnt = cnt;
+      r->released = timer_ticks ();
+      list_push_back (&releases, &r->elem);
+    }
+  else
+    {
+      /* Without a file there is nothing on disk to order against;
+         without memory, give up on the ordering. */
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      count_run (sector, cnt, false);
+      mark_dirty (sector, cnt);
+      free (r);
+    }
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors allocated so far to the free map on disk and
+   returns once they are there, so that no metadata written after
+   this can point at a sector the map on disk calls free. */
+void
+free_map_sync (void)
+{
+  if (free_map_file == NULL)
+    return;
+
+  lock_acquire (&free_map_lock);
+  write_dirty ();
+  lock_release (&free_map_lock);
+}
+
+/* Frees the sectors released at or before tick BEFORE, once the
+   cache blocks dirtied by then are on disk, and writes the result
+   to the free map on disk.  The wait for the cache happens without
+   free_map_lock, so allocation goes on meanwhile. */
+void
+free_map_commit (int64_t before)
+{
+  struct list due;
+
+  if (free_map_file == NULL)
+    return;
+
+  list_init (&due);
+  lock_acquire (&free_map_lock);
+  while (!list_empty (&releases)
+         && list_entry (list_front (&releases), struct release,
+                        elem)->released <= before)
+    list_push_back (&due, list_pop_front (&releases));
+  lock_release (&free_map_lock);
+  if (list_empty (&due))
+    return;
+
+  cache_flush_before (before);
+
+  lock_acquire (&free_map_lock);
+  while (!list_empty (&due))
+    {
+      struct release *r = list_entry (list_pop_front (&due),
+                                      struct release, elem);
+      bitmap_set_multiple (free_map, r->sector, r->cnt, false);
+      count_run (r->sector, r->cnt, false);
+      mark_dirty (r->sector, r->cnt);
+      free (r);
+    }
+  write_dirty ();
+  lock_release (&free_map_lock);
+}
+
+/* Marks the parts of the free map file holding the bits for CNT
+   sectors starting at SECTOR as changed.  The caller must hold
+   free_map_lock. */
+static void
+mark_dirty (disk_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Counts the free sectors of every group from scratch. */
+static void
+count_groups (void)
+{
+  size_t g;
+
+  for (g = 0; g < group_cnt; g++)
+    {
+      size_t start = g * GROUP_SECTORS;
+      size_t cnt = bitmap_size (free_map) - start;
+      if (cnt > GROUP_SECTORS)
+        cnt = GROUP_SECTORS;
+      group_free[g] = bitmap_count (free_map, start, cnt, false);
+    }
+}
+
+/* Accounts for CNT sectors starting at SECTOR having become USED,
+   or free if USED is false.  The caller must hold free_map_lock. */
+static void
+count_run (disk_sector_t sector, size_t cnt, bool used)
+{
+  while (cnt > 0)
+    {
+      size_t g = sector / GROUP_SECTORS;
+      size_t n = (g + 1) * GROUP_SECTORS - sector;
+      if (n > cnt)
+        n = cnt;
+      if (used)
+        group_free[g] -= n;
+      else
+        group_free[g] += n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns true if group G may hold CNT free sectors in a row. */
+static bool
+group_fits (size_t g, size_t cnt)
+{
+  return cnt > GROUP_SECTORS || group_free[g] >= cnt;
+}
+
+/* Finds CNT free sectors in a row, preferring the goal's group
+   from GOAL on, then the groups after it in turn, wrapping around
+   at the end of the disk.  Returns the first sector, or
+   BITMAP_ERROR if there is no such run.  The caller must hold
+   free_map_lock. */
+static size_t
+scan_groups (size_t cnt, disk_sector_t goal)
+{
+  size_t first, i, sector;
+
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  first = goal / GROUP_SECTORS;
+  if (group_fits (first, cnt))
+    {
+      sector = bitmap_scan (free_map, goal, cnt, false);
+      if (sector != BITMAP_ERROR && sector / GROUP_SECTORS == first)
+        return sector;
+    }
+
+  for (i = 1; i <= group_cnt; i++)
+    {
+      size_t g = (first + i) % group_cnt;
+      if (!group_fits (g, cnt))
+        continue;
+      sector = bitmap_scan (free_map, g * GROUP_SECTORS, cnt, false);
+      if (sector != BITMAP_ERROR)
+        return sector;
+
+      /* Nothing fits from G to the end of the disk. */
+      if (g <= first)
+        break;
+      i = group_cnt - first - 1;
+    }
+
+  /* A run may still straddle groups that each looked too full. */
+  return bitmap_scan (free_map, 0, cnt, false);
+}
+
+/* Called when the free map has no room: frees any pending
+   releases at once.  Returns true if there were any. */
+static bool
+commit_releases (void)
+{
+  bool pending;
+
+  lock_acquire (&free_map_lock);
+  pending = !list_empty (&releases);
+  lock_release (&free_map_lock);
+  if (pending)
+    free_map_commit (timer_ticks ());
+  return pending;
+}
+
+/* Writes the changed sectors of the free map file and waits for
+   them to reach the disk.  The caller must hold free_map_lock. */
+static void
+write_dirty (void)
+{
+  size_t i = 0;
+  bool wrote = false;
+
+  while ((i = bitmap_scan (free_map_dirty, i, 1, true)) != BITMAP_ERROR)
+    {
+      bitmap_reset (free_map_dirty, i);
+      if (!bitmap_write_part (free_map, free_map_file, i * DISK_SECTOR_SIZE,
+                              DISK_SECTOR_SIZE))
+        PANIC ("can't write free map");
+      wrote = true;
+    }
+  if (wrote)
+    inode_flush (file_get_inode (free_map_file));
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,12 +359,15 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  count_groups ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_sync ();
+  free_map_commit (INT64_MAX);
   file_close (free_map_file);
 }
 
@@ -81,4 +386,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
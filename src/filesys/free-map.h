@@ -3,15 +3,19 @@
 
 #include <stdbool.h>
 #include <stddef.h>
-#include "devices/disk.h"
+#include <stdint.h>
+#include "devices/block.h"
 
 void free_map_init (void);
 void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_sync (void);
+void free_map_commit (int64_t before);
 
-bool free_map_allocate (size_t, disk_sector_t *);
+bool free_map_allocate (size_t, disk_sector_t goal, disk_sector_t *);
+size_t free_map_allocate_run (size_t, disk_sector_t goal, disk_sector_t *);
 void free_map_release (disk_sector_t, size_t);
 
 #endif /* filesys/free-map.h */
@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -13,17 +14,53 @@
 #define DIRECT_BLOCK 122
 #define BLOCK_PER_INDIRECT_BLOCK 128
 
+/* Ways an inode_disk can map its data. */
+#define INODE_BLOCKS 0          /* Direct, indirect, doubly indirect. */
+#define INODE_EXTENTS 1         /* Runs of consecutive sectors. */
+
+/* Extents an INODE_EXTENTS inode has room for, in place of its
+   block pointers. */
+#define EXTENT_CNT ((DIRECT_BLOCK + 2) / 2)
+
+/* WRITTEN is 16 bits wide, as inode_disk has no room for more, so
+   a file is limited to the sectors it can count.  Writes past this
+   length come up short. */
+#define INODE_MAX_LENGTH ((off_t) UINT16_MAX * DISK_SECTOR_SIZE)
+
+/* Create new inodes as INODE_EXTENTS?  Set by -extents. */
+bool inode_use_extents;
+
+/* A run of LENGTH consecutive data sectors starting at START.
+   Extents map the file in order; the first with zero length ends
+   the list. */
+struct extent
+  {
+    disk_sector_t start;
+    uint32_t length;
+  };
+
 bool writing;
 /* On-disk inode.
    Must be exactly DISK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    disk_sector_t block[DIRECT_BLOCK];                /* First data sector. */
-    disk_sector_t sindirect;
-	disk_sector_t dindirect;
+    union
+      {
+        struct
+          {
+            disk_sector_t block[DIRECT_BLOCK];  /* First data sector. */
+            disk_sector_t sindirect;
+            disk_sector_t dindirect;
+          };
+        struct extent extents[EXTENT_CNT];     /* INODE_EXTENTS. */
+      };
     disk_sector_t parent;
 
 	bool is_dir;
+    uint8_t format;                     /* INODE_BLOCKS or INODE_EXTENTS. */
+    uint16_t written;                   /* Sectors below this index have
+                                           been written; the rest of the
+                                           mapped ones read as zeros. */
 	off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
     //uint32_t unused[125];               /* Not used. */
@@ -35,44 +72,33 @@ struct indirect_block{
 
 
 
-static disk_sector_t index_to_sector (struct inode_disk *i, off_t index){
-  disk_sector_t target;
-  
-  // direct
-  if (index < DIRECT_BLOCK){
-	target = i->block[index];
-	//ASSERT(target != -1);
-	return target;
-  }
-//  index = index - DIRECT_BLOCK;
-  
-  // single indirect
-  if (index < DIRECT_BLOCK + BLOCK_PER_INDIRECT_BLOCK){
-	struct indirect_block *temp = calloc (1, sizeof *temp);
-	disk_read (filesys_disk, i->sindirect, temp);
-	
-	target = temp->block[index-DIRECT_BLOCK];
-	free(temp);
-	return target;
-  }
- // index = index - BLOCK_PER_INDIRECT_BLOCK;
-
-  // double indirect
-  off_t sindex = (index-DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) / BLOCK_PER_INDIRECT_BLOCK;
-  off_t dindex = (index-DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) % BLOCK_PER_INDIRECT_BLOCK;
+/* Reads entry IDX of the indirect block in SECTOR. */
+static disk_sector_t
+indirect_get (disk_sector_t sector, off_t idx)
+{
+  disk_sector_t entry;
+  cache_read (sector, &entry, idx * sizeof entry, sizeof entry);
+  return entry;
+}
 
-  struct indirect_block *tem = calloc (1, sizeof *tem);
-  struct indirect_block *tem2 = calloc (1, sizeof *tem2);
-  disk_read (filesys_disk, i->dindirect, tem);
-  disk_read (filesys_disk, tem->block[sindex], tem2);
-  
-  target = tem2->block[dindex];
-  free (tem);
-  free (tem2);
-  if (target == -1)
-	printf("index = [%d], sindex = [%d], dindex = [%d]\n", index, sindex, dindex);
-  ASSERT (target != -1);
-  return target;
+/* Returns the sector of the indirect block that maps data sector
+   INDEX of I, an index past the direct blocks, and stores INDEX's
+   position within that block in *IDX.  Returns 0 if that indirect
+   block is a hole. */
+static disk_sector_t
+index_to_indirect (const struct inode_disk *i, off_t index, off_t *idx)
+{
+  index -= DIRECT_BLOCK;
+  if (index < BLOCK_PER_INDIRECT_BLOCK)
+    {
+      *idx = index;
+      return i->sindirect;
+    }
+  index -= BLOCK_PER_INDIRECT_BLOCK;
+  *idx = index % BLOCK_PER_INDIRECT_BLOCK;
+  if (i->dindirect == 0)
+    return 0;
+  return indirect_get (i->dindirect, index / BLOCK_PER_INDIRECT_BLOCK);
 }
 
 
@@ -84,71 +110,152 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
+/* Returns how many data sector indexes an inode SIZE bytes long
+   can map.  inode_alloc() maps one sector more than the data
+   needs, so that even an empty inode has one; in a sparse
+   block-mapped inode any of them may still be a hole. */
+static inline off_t
+mapped_sectors (off_t size)
+{
+  return bytes_to_sectors (size) + 1;
+}
+
+/* Number of consecutive block-map entries an open inode keeps
+   from its last lookup in an indirect block. */
+#define MAP_CACHE_SIZE 16
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
+    bool loading;                       /* Being read in by its opener. */
+    bool bad;                           /* SECTOR held no inode. */
+    struct condition loaded;            /* Signaled when LOADING clears. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
     disk_sector_t parent;
-	off_t length;
-	struct lock lock;
+	off_t length;                       /* Readable length, set last. */
+	off_t mapped;                       /* Sectors in the block map. */
+	struct lock grow_lock;              /* Serializes growth, WRITTEN. */
+	struct lock lock;                   /* Serializes directory updates. */
 	bool is_dir;
+
+    /* Block-map cache: data sector indexes map_first through
+       map_first + map_cnt - 1 live in map_cache. */
+    struct lock map_lock;
+    off_t map_first;
+    off_t map_cnt;
+    disk_sector_t map_cache[MAP_CACHE_SIZE];
   };
 
+/* Returns the data sector for sector index INDEX of extent-mapped
+   I, or -1 if INDEX is not mapped. */
+static disk_sector_t
+extent_to_sector (const struct inode_disk *i, off_t index)
+{
+  int e;
+
+  for (e = 0; e < EXTENT_CNT && i->extents[e].length > 0; e++)
+    {
+      if (index < (off_t) i->extents[e].length)
+        return i->extents[e].start + index;
+      index -= i->extents[e].length;
+    }
+  return -1;
+}
+
+/* Returns the data sector for sector index INDEX of INODE, or 0
+   if INDEX is a hole in a block-mapped file.  Direct blocks and
+   extents come straight from the in-memory inode_disk; indirect
+   lookups go through the map cache, which is refilled from the
+   buffer cache on a miss. */
+static disk_sector_t
+index_to_sector (struct inode *inode, off_t index)
+{
+  disk_sector_t sector, target;
+  off_t idx, cnt;
+
+  if (inode->data.format == INODE_EXTENTS)
+    return extent_to_sector (&inode->data, index);
+  if (index < DIRECT_BLOCK)
+    return inode->data.block[index];
+
+  lock_acquire (&inode->map_lock);
+  if (index < inode->map_first || index >= inode->map_first + inode->map_cnt)
+    {
+      /* Only cache entries below the mapped bound: the rest of
+         the indirect block may still change.  block_map() drops
+         the cache when it fills a hole. */
+      sector = index_to_indirect (&inode->data, index, &idx);
+      if (sector == 0)
+        {
+          lock_release (&inode->map_lock);
+          return 0;
+        }
+      cnt = BLOCK_PER_INDIRECT_BLOCK - idx;
+      if (cnt > MAP_CACHE_SIZE)
+        cnt = MAP_CACHE_SIZE;
+      if (cnt > inode->mapped - index)
+        cnt = inode->mapped - index;
+      cache_read (sector, inode->map_cache, idx * sizeof *inode->map_cache,
+                  cnt * sizeof *inode->map_cache);
+      inode->map_first = index;
+      inode->map_cnt = cnt;
+    }
+  target = inode->map_cache[index - inode->map_first];
+  lock_release (&inode->map_lock);
+  return target;
+}
+
 /* Returns the disk sector that contains byte offset POS within
    INODE.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.  A writer may map sectors past the published length before
+   it writes them. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  /*
-  if (pos < inode->data.length)
-    return inode->data.start + pos / DISK_SECTOR_SIZE;
-  */
-  disk_sector_t ret;
-  if (0 <= pos && pos < inode->length){
-	off_t index = pos / DISK_SECTOR_SIZE;
-	struct inode_disk *temp = calloc (1, sizeof (*temp));
-	if (temp == NULL)
-	  PANIC("byte_to_sector can't calloc");
-
-	disk_read (filesys_disk, inode->sector, temp);
-//HAVE to do
-	//ret = index_to_sector (&inodei->data, index);
-	ret = index_to_sector (temp, index);
-	free (temp);
-	return ret;
-
-	//return index_to_sector (inode, index);
-	//return inode->start + pos / DISK_SECTOR_SIZE;
-  }else
-	return -1;
-    //printf("BTS: pos = [%d], length = [%d]\n", pos, inode->length);
-	//PANIC("WHAT'sup");
-}
-
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+  if (0 <= pos && pos / DISK_SECTOR_SIZE < inode->mapped)
+    return index_to_sector (inode, pos / DISK_SECTOR_SIZE);
+  else
+    return -1;
+}
+
+/* Writes INODE's in-memory inode_disk back through the cache. */
+static void
+inode_write_disk (struct inode *inode)
+{
+  cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Guards open_inodes and every inode's open_cnt, LOADING and
+   BAD.  Never held across disk I/O. */
+static struct lock open_inodes_lock;
+
+static unsigned inode_hash (const struct hash_elem *, void *aux);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *aux);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
-  lock_init (&i_lock);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  lock_init (&open_inodes_lock);
   writing = false;
 }
 
 bool
-inode_extend (struct inode_disk *i, off_t current, off_t new);
-bool inode_alloc (struct inode_disk *i, off_t length);
+inode_extend (struct inode_disk *i, disk_sector_t home, off_t current, off_t new);
+bool inode_alloc (struct inode_disk *i, disk_sector_t home, off_t length);
 
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -156,90 +263,259 @@ bool inode_alloc (struct inode_disk *i, off_t length);
    disk.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
-bool inode_extend (struct inode_disk *i, off_t current, off_t new){
-  static char zeros[DISK_SECTOR_SIZE];
-  /*
-  size_t current = bytes_to_sectors (length1);
-  size_t new = bytes_to_sectors (length2);
-  */
-  if (new <current)
+static bool extent_extend (struct inode_disk *, disk_sector_t home,
+                           off_t current, off_t new);
+
+/* Grows the mapping of I from sector index CURRENT to NEW.
+   Extents cannot describe holes, so an extent-mapped file is
+   mapped in full.  A block-mapped file is sparse: growing it maps
+   nothing, and block_map() fills in sectors as they are written.
+   HOME is the sector holding I itself. */
+bool inode_extend (struct inode_disk *i, disk_sector_t home, off_t current, off_t new){
+  if (i->format == INODE_EXTENTS)
+	return extent_extend (i, home, current, new);
+  return new >= current;
+}
+
+/* Maps sector indexes CURRENT + 1 through NEW of extent-mapped I.
+   Each allocation asks for all the sectors still needed, starting
+   right after the last extent, or after the inode in HOME for the
+   first, so that a file grown in one go is laid out in as few
+   extents as the free map allows, next to its inode.  The new
+   sectors are left unwritten.  On failure, whatever was mapped
+   here is released again and I is left as it was. */
+static bool extent_extend (struct inode_disk *i, disk_sector_t home, off_t current, off_t new){
+  int e, first;
+  uint32_t last_length;
+
+  /* WRITTEN must be able to count every mapped sector. */
+  if (new < current || new > UINT16_MAX)
 	return false;
-  if (new == current)
-	return true;
-  bool success = true;
-  while (current < new && success){
-	current ++;
-	/*
-	if (current % 1000 == 0)
-	  printf("inode_extend: [current = %d], [new = %d]\n", current, new);
-	*/
-	if (current < DIRECT_BLOCK){
-	  success = free_map_allocate (1, &i->block[current]);
-	  disk_write (filesys_disk, i->block[current], zeros);
-	  continue;
+  for (e = 0; e < EXTENT_CNT && i->extents[e].length > 0; e++)
+	continue;
+  first = e;
+  last_length = e > 0 ? i->extents[e - 1].length : 0;
+  while (current < new){
+	struct extent *last = e > 0 ? &i->extents[e - 1] : NULL;
+	disk_sector_t goal = last != NULL ? last->start + last->length : home + 1;
+	disk_sector_t start;
+	size_t cnt;
+
+	cnt = free_map_allocate_run (new - current, goal, &start);
+	if (cnt == 0)
+	  goto fail;
+	if (last != NULL && start == goal)
+	  last->length += cnt;
+	else if (e < EXTENT_CNT){
+	  i->extents[e].start = start;
+	  i->extents[e].length = cnt;
+	  e++;
 	}
-   /*
-	if (current == DIRECT_BLOCK){
-	  success = free_map_allocate (1, &i->sindirect);
-	  
-	}*/
-	if (current < DIRECT_BLOCK + BLOCK_PER_INDIRECT_BLOCK){
-//	  success = inode_extension_sindirect (i, index-DIRECT_BLOCK);
-	  struct indirect_block *temp = calloc (1, sizeof *temp);
-	  if (current == DIRECT_BLOCK){
-		success = free_map_allocate (1, &i->sindirect);
-		disk_write (filesys_disk, i->sindirect, zeros);
-	  }
-//	  else
-		disk_read (filesys_disk, i->sindirect, temp);
-
-	  success = free_map_allocate (1, &temp->block[(current-DIRECT_BLOCK)]);
-	  //PANIC("here?");
-	  disk_write (filesys_disk, temp->block[(current-DIRECT_BLOCK)], zeros);
-	  disk_write (filesys_disk, i->sindirect, temp);
-	  free(temp);
-      
-	  continue;
+	else{
+	  free_map_release (start, cnt);
+	  goto fail;
 	}
-	
-	
-    off_t sindex = (current - DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) / BLOCK_PER_INDIRECT_BLOCK;
-	off_t dindex = (current - DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) % BLOCK_PER_INDIRECT_BLOCK;
-	
-	struct indirect_block *tem = calloc (1, sizeof *tem);
-	struct indirect_block *tem2 = calloc (1, sizeof *tem2);
-	if (sindex == 0 && dindex == 0){
-	  success = free_map_allocate (1, &i->dindirect);
-	  disk_write (filesys_disk, i->dindirect, zeros);
+	current += cnt;
+  }
+  return true;
+
+ fail:
+  if (first > 0){
+	struct extent *last = &i->extents[first - 1];
+	if (last->length > last_length)
+	  free_map_release (last->start + last_length, last->length - last_length);
+	last->length = last_length;
+  }
+  for (; first < e; first++){
+	free_map_release (i->extents[first].start, i->extents[first].length);
+	i->extents[first].start = 0;
+	i->extents[first].length = 0;
+  }
+  return false;
+}
+
+/* Sectors allocated ahead of use by block_map(): LEFT of them,
+   starting at NEXT. */
+struct sector_run
+  {
+    disk_sector_t next;
+    size_t left;
+  };
+
+/* Takes the next sector of R into *SECTOR, first allocating a
+   new run of up to WANT sectors if R is used up, placed right
+   after the old one if possible. */
+static bool
+run_take (struct sector_run *r, size_t want, disk_sector_t *sector)
+{
+  if (r->left == 0)
+    {
+      r->left = free_map_allocate_run (want, r->next, &r->next);
+      if (r->left == 0)
+        return false;
+    }
+  *sector = r->next++;
+  r->left--;
+  return true;
+}
+
+/* An indirect block being filled in by block_map(), which
+   writes it back once, when it moves on to another block or
+   finishes. */
+struct indirect_buf
+  {
+    disk_sector_t sector;               /* NO_SECTOR if none. */
+    struct indirect_block b;
+  };
+
+#define NO_SECTOR ((disk_sector_t) -1)
+
+/* A sector's worth of zeros. */
+static const uint8_t zeros[DISK_SECTOR_SIZE];
+
+/* Writes back IB's block, if it has one. */
+static void
+indirect_buf_flush (struct indirect_buf *ib)
+{
+  if (ib->sector != NO_SECTOR)
+    cache_write (ib->sector, &ib->b, 0, DISK_SECTOR_SIZE);
+}
+
+/* Makes IB hold the indirect block in SECTOR, writing back the
+   one it held before.  A FRESH block starts out all zeros rather
+   than being read. */
+static void
+indirect_buf_load (struct indirect_buf *ib, disk_sector_t sector, bool fresh)
+{
+  if (ib->sector == sector)
+    return;
+  indirect_buf_flush (ib);
+  ib->sector = sector;
+  if (fresh)
+    memset (&ib->b, 0, sizeof ib->b);
+  else
+    cache_read (sector, &ib->b, 0, DISK_SECTOR_SIZE);
+}
+
+/* Makes IB hold the indirect block *SECTOR points to.  If it is
+   a hole, first takes a sector for it from RUN, asking for WANT,
+   and zeroes the sector before pointing *SECTOR at it, so that a
+   concurrent reader finds holes there rather than garbage. */
+static bool
+map_indirect (struct sector_run *run, size_t want, disk_sector_t *sector,
+              struct indirect_buf *ib)
+{
+  bool fresh = *sector == 0;
+
+  if (fresh)
+    {
+      disk_sector_t new_sector;
+
+      if (!run_take (run, want, &new_sector))
+        return false;
+      cache_write (new_sector, zeros, 0, DISK_SECTOR_SIZE);
+      *sector = new_sector;
+    }
+  indirect_buf_load (ib, *sector, fresh);
+  return true;
+}
+
+/* Maps every hole among sector indexes FIRST through LAST of
+   block-mapped INODE, which is how a sparse file gets its sectors
+   as they are first written.  Data and indirect sectors alike
+   come out of runs allocated as a whole, continuing from the
+   sector before FIRST where possible.  Each indirect block touched
+   is read and written back once.  With no sector before FIRST,
+   the run starts right after the inode.  New data sectors below
+   WRITTEN are zeroed before they are mapped, since readers may
+   reach them; the rest are left for inode_write_fresh().  Sets
+   *CHANGED if the on-disk inode must be written back. */
+static bool
+block_map (struct inode *inode, off_t first, off_t last, bool *changed)
+{
+  struct inode_disk *i = &inode->data;
+  struct sector_run run;
+  struct indirect_buf *leaf, *top;
+  disk_sector_t prev;
+  off_t index;
+  bool filled = false, success = true;
+
+  leaf = malloc (sizeof *leaf);
+  top = malloc (sizeof *top);
+  if (leaf == NULL || top == NULL){
+	free (leaf);
+	free (top);
+	return false;
+  }
+  leaf->sector = top->sector = NO_SECTOR;
+
+  prev = first > 0 ? index_to_sector (inode, first - 1) : 0;
+  run.left = 0;
+  run.next = (prev != 0 ? prev : inode->sector) + 1;
+
+  for (index = first; index <= last && success; index++){
+	disk_sector_t *slot, sector;
+	size_t want = last - index + 1;
+
+	if (index < DIRECT_BLOCK)
+	  slot = &i->block[index];
+	else if (index < DIRECT_BLOCK + BLOCK_PER_INDIRECT_BLOCK){
+	  if (i->sindirect == 0)
+		*changed = true;
+	  if (!map_indirect (&run, want + 1, &i->sindirect, leaf)){
+		success = false;
+		break;
+	  }
+	  slot = &leaf->b.block[index - DIRECT_BLOCK];
 	}
-	  //	else
-	disk_read (filesys_disk, i->dindirect, tem);
-	
-	if (dindex == 0){
-	  success = free_map_allocate (1, &tem->block[sindex]);
-	  disk_write (filesys_disk, tem->block[sindex], zeros);
+	else{
+	  off_t sindex = (index - DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) / BLOCK_PER_INDIRECT_BLOCK;
+	  off_t dindex = (index - DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) % BLOCK_PER_INDIRECT_BLOCK;
+
+	  if (i->dindirect == 0)
+		*changed = true;
+	  if (!map_indirect (&run, want + 2, &i->dindirect, top)
+		  || !map_indirect (&run, want + 1, &top->b.block[sindex], leaf)){
+		success = false;
+		break;
+	  }
+	  slot = &leaf->b.block[dindex];
 	}
+	if (*slot != 0)
+	  continue;
 
-	disk_read (filesys_disk, tem->block[sindex], tem2);
-	success= free_map_allocate (1, &tem2->block[dindex]);
-	disk_write (filesys_disk, tem2->block[dindex], zeros);
-	disk_write (filesys_disk, tem->block[sindex], tem2);
-	disk_write (filesys_disk, i->dindirect, tem);
+	success = run_take (&run, want, &sector);
+	if (success){
+	  if (index < i->written)
+		cache_write (sector, zeros, 0, DISK_SECTOR_SIZE);
+	  *slot = sector;
+	  filled = true;
+	  if (index < DIRECT_BLOCK)
+		*changed = true;
+	}
+  }
 
-	free (tem);
-	free (tem2);
-//PANIC("SEX");
-	continue;
+  indirect_buf_flush (leaf);
+  indirect_buf_flush (top);
+  if (run.left > 0)
+	free_map_release (run.next, run.left);
+  free (leaf);
+  free (top);
+
+  /* The map cache may hold holes that are now filled. */
+  if (filled){
+	lock_acquire (&inode->map_lock);
+	inode->map_cnt = 0;
+	lock_release (&inode->map_lock);
   }
-	
   return success; 
 }
 
-bool inode_alloc (struct inode_disk *i, off_t length){
+bool inode_alloc (struct inode_disk *i, disk_sector_t home, off_t length){
   if (length <0)
 	return false;
   off_t size = bytes_to_sectors (length);
-  return inode_extend (i, -1, size);
+  return inode_extend (i, home, -1, size);
 }
 
 bool
@@ -262,23 +538,24 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir)
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
 	  disk_inode->is_dir = is_dir;
+	  disk_inode->format = inode_use_extents ? INODE_EXTENTS : INODE_BLOCKS;
 	  disk_inode->parent = ROOT_DIR_SECTOR;
-	  if (inode_alloc (disk_inode, length)){
+	  if (inode_alloc (disk_inode, sector, length)){
 		//PANIC("WHAT");
-		disk_write (filesys_disk, sector, disk_inode);
+		cache_write (sector, disk_inode, 0, DISK_SECTOR_SIZE);
 	    success = true;
 	  }
  	  /*
 	  if (free_map_allocate (sectors, &disk_inode->start))
         {
-          disk_write (filesys_disk, sector, disk_inode);
+          block_write (filesys_disk, sector, disk_inode);
           if (sectors > 0) 
             {
               static char zeros[DISK_SECTOR_SIZE];
               size_t i;
               
               for (i = 0; i < sectors; i++) 
-                disk_write (filesys_disk, disk_inode->start + i, zeros); 
+                block_write (filesys_disk, disk_inode->start + i, zeros); 
             }
           success = true; 
         }
@@ -291,50 +568,82 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails or SECTOR
+   holds no inode.  The inode is entered in open_inodes before it
+   is read, marked LOADING, and the read happens without
+   open_inodes_lock, so that a miss does not hold up every other
+   open; openers of the same sector wait for it meanwhile. */
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
+  bool bad;
 
-  //lock_acquire (&i_lock);
+  lock_acquire (&open_inodes_lock);
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      if (inode->bad)
         {
-          inode_reopen (inode);
-          return inode; 
+          if (--inode->open_cnt == 0)
+            free (inode);
+          inode = NULL;
         }
+      lock_release (&open_inodes_lock);
+      return inode;
     }
-  
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->loading = true;
+  inode->bad = false;
+  cond_init (&inode->loaded);
+  lock_release (&open_inodes_lock);
   
+  lock_init (&inode->grow_lock);
   lock_init (&inode->lock);
-  //disk_read (filesys_disk, inode->sector, &inode->data);
-  struct inode_disk *data = calloc (1, sizeof *data);
-  disk_read (filesys_disk, inode->sector, data);
-  //disk_read (filesys_disk, inode->sector, &inode->data);
-  //inode->start = datastart;
-  inode->length = data->length;
-  inode->is_dir = data->is_dir;
-  inode->parent = data->parent;
-  free (data);
-  //lock_release (&i_lock);
+  lock_init (&inode->map_lock);
+  inode->map_first = 0;
+  inode->map_cnt = 0;
+  cache_read (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+  inode->length = inode->data.length;
+  inode->mapped = mapped_sectors (inode->length);
+  inode->is_dir = inode->data.is_dir;
+  inode->parent = inode->data.parent;
+  bad = inode->data.magic != INODE_MAGIC;
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  if (bad)
+    {
+      hash_delete (&open_inodes, &inode->elem);
+      inode->bad = true;
+      if (--inode->open_cnt == 0)
+        free (inode);
+      inode = NULL;
+    }
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -343,7 +652,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -372,11 +685,12 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
-  //lock_acquire (&i_lock);
+  lock_acquire (&open_inodes_lock);
   if (--inode->open_cnt == 0)
     {
       /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      hash_delete (&open_inodes, &inode->elem);
+      lock_release (&open_inodes_lock);
 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
@@ -399,58 +713,63 @@ inode_close (struct inode *inode)
 
       free (inode); 
     }
-  //lock_release (&i_lock);
+  else
+    lock_release (&open_inodes_lock);
 }
 
 void inode_free (struct inode *inode){
-  struct inode_disk *ib = calloc (1, sizeof *ib);
-
-  disk_read (filesys_disk, inode->sector, ib);
-  off_t index = bytes_to_sectors (inode->length);
-  inode_dealloc (ib, index);
-  free (ib);
+  inode_dealloc (&inode->data, bytes_to_sectors (inode->length));
 }
 
 
+/* Releases data or indirect sector SECTOR, unless it is a hole. */
+static void
+release_sector (disk_sector_t sector)
+{
+  if (sector != 0)
+    free_map_release (sector, 1);
+}
+
 bool inode_dealloc (struct inode_disk *i, off_t index){
   if (index < 0)
 	return false;
 
+  if (i->format == INODE_EXTENTS){
+	int e;
+	for (e = 0; e < EXTENT_CNT && i->extents[e].length > 0; e++)
+	  free_map_release (i->extents[e].start, i->extents[e].length);
+	return true;
+  }
+
   off_t current = index+1;
   while (current != 0){
 	current--;
 
 	if (current < DIRECT_BLOCK){
-	  free_map_release (i->block[current], 1);  
+	  release_sector (i->block[current]);
 	  continue;
 	}
 	if (current < DIRECT_BLOCK + BLOCK_PER_INDIRECT_BLOCK){
-	  struct indirect_block *temp = calloc (1, sizeof *temp);
-	  disk_read (filesys_disk, i->sindirect, temp);
-	  free_map_release (temp->block[(current-DIRECT_BLOCK)], 1);
+	  if (i->sindirect == 0)
+		continue;
+	  release_sector (indirect_get (i->sindirect, current - DIRECT_BLOCK));
 	  if (current == DIRECT_BLOCK)
-		free_map_release (i->sindirect, 1);
-
-	  free (temp);
+		release_sector (i->sindirect);
 	  continue;
 	}
+	if (i->dindirect == 0)
+	  continue;
 	off_t sindex = (current - DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) / BLOCK_PER_INDIRECT_BLOCK;
 	off_t dindex = (current - DIRECT_BLOCK - BLOCK_PER_INDIRECT_BLOCK) % BLOCK_PER_INDIRECT_BLOCK;
+	disk_sector_t sindirect = indirect_get (i->dindirect, sindex);
 
-	struct indirect_block *tem = calloc (1, sizeof *tem);
-	struct indirect_block *tem2 = calloc (1, sizeof *tem2);
-
-	disk_read (filesys_disk, i->dindirect, tem);
-	disk_read (filesys_disk, tem->block[sindex], tem2);
-	free_map_release (tem2->block[dindex], 1);
-
-	if (dindex == 0)
-	  free_map_release (tem->block[sindex], 1);
-	if (sindex == 0)
-	  free_map_release (i->dindirect, 1);
-
-	free (tem);
-	free (tem2);
+	if (sindirect != 0){
+	  release_sector (indirect_get (sindirect, dindex));
+	  if (dindex == 0)
+		release_sector (sindirect);
+	}
+	if (sindex == 0 && dindex == 0)
+	  release_sector (i->dindirect);
   }
   return true;
 }
@@ -468,6 +787,36 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Brings the sectors holding bytes OFFSET up to END of INODE into
+   the cache before a read that spans several of them.  Each run
+   of them that lies contiguous on disk is loaded with a single
+   disk command, rather than one per sector as the read would. */
+static void
+inode_load (struct inode *inode, off_t offset, off_t end)
+{
+  disk_sector_t first = 0;
+  size_t cnt = 0;
+
+  if (end > inode->data.written * DISK_SECTOR_SIZE)
+    end = inode->data.written * DISK_SECTOR_SIZE;
+  for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+       offset += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector = byte_to_sector (inode, offset);
+      if (cnt > 0 && sector == first + cnt)
+        {
+          cnt++;
+          continue;
+        }
+      if (cnt > 1)
+        cache_load (first, cnt);
+      first = sector;
+      cnt = sector != 0;
+    }
+  if (cnt > 1)
+    cache_load (first, cnt);
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -477,8 +826,14 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
-  //lock_acquire (&i_lock);
-  //ASSERT (inode != NULL);
+  off_t length;
+
+  /* Takes no lock: everything below LENGTH is in place before
+     a writer publishes it. */
+  length = inode_length (inode);
+  barrier ();
+  if (size > DISK_SECTOR_SIZE)
+    inode_load (inode, offset, offset + size < length ? offset + size : length);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -486,7 +841,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       int sector_ofs = offset % DISK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = DISK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -498,7 +853,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
         {
            //Read full sector directly into caller's buffer. 
-          disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
+          block_read (filesys_disk, sector_idx, buffer + bytes_read); 
         }
       else 
         {
@@ -510,17 +865,16 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
               if (bounce == NULL)
                 break;
             }
-          disk_read (filesys_disk, sector_idx, bounce);
+          block_read (filesys_disk, sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
 */
       
 	  
-	  struct cache_entry *e = cache_return (sector_idx, false);
-	  memcpy (buffer + bytes_read, (uint8_t *)e->buf + sector_ofs, chunk_size);
-	  ASSERT (e->sector == sector_idx);
-	  e->in_use--;
-	  e->access = true;
+	  if (offset / DISK_SECTOR_SIZE >= inode->data.written || sector_idx == 0)
+	    memset (buffer + bytes_read, 0, chunk_size);
+	  else
+	    cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 	  
 
       /* Advance. */
@@ -529,10 +883,103 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       bytes_read += chunk_size;
     }
   free (bounce);
-//  lock_release (&i_lock);
   return bytes_read;
 }
 
+/* Queues the sectors holding SIZE bytes of INODE, starting at
+   OFFSET, for read-ahead.  Sectors past end of file are skipped. */
+void
+inode_read_ahead (struct inode *inode, off_t size, off_t offset)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (end > inode->data.written * DISK_SECTOR_SIZE)
+    end = inode->data.written * DISK_SECTOR_SIZE;
+  for (offset = ROUND_DOWN (offset, DISK_SECTOR_SIZE); offset < end;
+       offset += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
+/* Returns the first sector index after hole INDEX of block-mapped
+   INODE that may be mapped, or END if there is none before it.  A
+   missing indirect block is skipped whole, without looking up each
+   of the sectors it would map. */
+static off_t
+hole_end (struct inode *inode, off_t index, off_t end)
+{
+  const off_t dbase = DIRECT_BLOCK + BLOCK_PER_INDIRECT_BLOCK;
+  off_t next = index + 1;
+
+  if (index >= DIRECT_BLOCK && index < dbase)
+    {
+      if (inode->data.sindirect == 0)
+        next = dbase;
+    }
+  else if (index >= dbase)
+    {
+      if (inode->data.dindirect == 0)
+        next = end;
+      else
+        {
+          /* Skip the following indirect blocks that are missing
+             too, one dindirect entry each. */
+          off_t slot = (index - dbase) / BLOCK_PER_INDIRECT_BLOCK;
+          off_t idx;
+
+          if (index_to_indirect (&inode->data, index, &idx) == 0)
+            {
+              next = dbase + (slot + 1) * BLOCK_PER_INDIRECT_BLOCK;
+              while (next < end
+                     && index_to_indirect (&inode->data, next, &idx) == 0)
+                next += BLOCK_PER_INDIRECT_BLOCK;
+            }
+        }
+    }
+  return next < end ? next : end;
+}
+
+/* Writes SIZE bytes from BUFFER to offset OFS of unwritten sector
+   index INDEX of INODE, which must be mapped, and marks it and any
+   unwritten sectors before it written.  Sectors are initialized
+   whole, with zeros around the data, without reading what the
+   disk holds there; holes are skipped.  *BOUNCE is allocated as
+   needed for that.  Returns false if memory runs out. */
+static bool
+inode_write_fresh (struct inode *inode, off_t index, const void *buffer,
+                   int ofs, int size, uint8_t **bounce)
+{
+  if (*bounce == NULL)
+    {
+      *bounce = malloc (DISK_SECTOR_SIZE);
+      if (*bounce == NULL)
+        return false;
+    }
+
+  memset (*bounce, 0, DISK_SECTOR_SIZE);
+  while (inode->data.written < index)
+    {
+      disk_sector_t sector = index_to_sector (inode, inode->data.written);
+      if (sector != 0)
+        {
+          cache_write (sector, *bounce, 0, DISK_SECTOR_SIZE);
+          inode->data.written++;
+        }
+      else
+        inode->data.written = hole_end (inode, inode->data.written, index);
+    }
+
+  memcpy (*bounce + ofs, buffer, size);
+  cache_write (index_to_sector (inode, index), *bounce, 0, DISK_SECTOR_SIZE);
+  inode->data.written = index + 1;
+  return true;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
@@ -545,39 +992,76 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   uint8_t *bounce = NULL;
+  uint16_t written;
+  off_t length, mapped;
+  bool grow, extended = false, remapped = false;
  
   //if (inode_is_dir (inode))
 	//return 0;
-  if (inode->deny_write_cnt)
+  if (inode->deny_write_cnt || offset >= INODE_MAX_LENGTH)
     return 0;
-  inode_lock (inode);
-
-  if ( offset + size > inode->length){
-	
-	//inode_lock (inode);
-
-	off_t len1 = bytes_to_sectors (inode->length);
+  if (size > INODE_MAX_LENGTH - offset)
+    size = INODE_MAX_LENGTH - offset;
+
+  /* A write that extends the file or reaches unwritten sectors
+     changes the block map or WRITTEN, so it takes the grow lock.
+     Any other write goes straight to the cache, alongside readers
+     and other writers. */
+  grow = (offset + size > inode->length
+          || (offset + size - 1) / DISK_SECTOR_SIZE >= inode->data.written);
+  if (grow)
+    lock_acquire (&inode->grow_lock);
+  length = inode->length;
+  mapped = inode->mapped;
+  written = inode->data.written;
+
+  /* Map the new sectors, but leave the length for after the data
+     is written. */
+  if ( offset + size > length){
+	off_t len1 = bytes_to_sectors (length);
 	off_t len2 = bytes_to_sectors (offset + size);
 
-	struct inode_disk *id = calloc (1, sizeof *id);
-	disk_read (filesys_disk, inode->sector, id);
-	if (!inode_extend (id, len1, len2))
-	  PANIC ("write extension failed");
-	inode->length = offset+size;
-	id->length = offset+size;
-	disk_write (filesys_disk, inode->sector, id);
-	free (id);
-	
-	//inode_unlock (inode);
+	/* Out of space or extents: write nothing. */
+	if (!inode_extend (&inode->data, inode->sector, len1, len2))
+	  size = 0;
+	else{
+	  inode->mapped = mapped_sectors (offset + size);
+	  length = offset + size;
+	  extended = true;
+	}
   }
-  inode_unlock (inode);
-  lock_acquire (&i_lock);
+  if (grow && size > 0 && inode->data.format == INODE_BLOCKS
+      && !block_map (inode, offset / DISK_SECTOR_SIZE,
+                     (offset + size - 1) / DISK_SECTOR_SIZE, &remapped))
+    {
+      /* Out of space: write nothing, and leave the file as long
+         as it was. */
+      size = 0;
+      if (extended)
+        {
+          inode->mapped = mapped;
+          extended = false;
+        }
+    }
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
       disk_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % DISK_SECTOR_SIZE;
 
+      /* A hole met without the grow lock: take it and map the rest
+         of the write. */
+      if (sector_idx == 0 && !grow)
+        {
+          lock_acquire (&inode->grow_lock);
+          grow = true;
+          written = inode->data.written;
+          if (!block_map (inode, offset / DISK_SECTOR_SIZE,
+                          (offset + size - 1) / DISK_SECTOR_SIZE, &remapped))
+            break;
+          sector_idx = byte_to_sector (inode, offset);
+        }
+
 	  if (sector_idx == -1){
 		printf("inode error: pos = [%d]. inode_length = [%d]\n", offset, inode->length);
 	  printf("[%d]\n", byte_to_sector (inode, offset));
@@ -585,7 +1069,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	  //ASSERT (sector_idx != -1);
 	  ASSERT (sector_idx < 0xcccccccc);
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = DISK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -600,7 +1084,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 
         {
           // Write full sector directly to disk. 
-          disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
+          block_write (filesys_disk, sector_idx, buffer + bytes_written); 
         }
       else 
         {
@@ -618,25 +1102,23 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
            //  we're writing, then we need to read in the sector
             // first.  Otherwise we start with a sector of all zeros. 
           if (sector_ofs > 0 || chunk_size < sector_left) 
-            disk_read (filesys_disk, sector_idx, bounce);
+            block_read (filesys_disk, sector_idx, bounce);
           else
             memset (bounce, 0, DISK_SECTOR_SIZE);
           memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          disk_write (filesys_disk, sector_idx, bounce); 
+          block_write (filesys_disk, sector_idx, bounce); 
         }
 	  
   	
 	 */
 	  //printf("here and "); 
 	  //ASSERT (sector_idx != 0xcccccccc)
-	  struct cache_entry *c = cache_return (sector_idx, true);
-	  //printf("tehre\n");
-	  //memcpy (c->buf + sector_ofs, bounce, chunk_size);
-
-	  memcpy (((uint8_t *)c->buf) + sector_ofs, buffer + bytes_written, chunk_size);
-	  
-	  ASSERT (c->sector == sector_idx);
-	  c->in_use--;
+	  if (offset / DISK_SECTOR_SIZE < inode->data.written)
+	    cache_write (sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+	  else if (!inode_write_fresh (inode, offset / DISK_SECTOR_SIZE,
+	                               buffer + bytes_written, sector_ofs,
+	                               chunk_size, &bounce))
+	    break;
 	
   //cache_destroy ();
 
@@ -647,19 +1129,74 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  lock_release (&i_lock);
-  cache_destroy();
+  if (grow)
+    {
+      /* Publish the new length now that the data is in place, only
+         as far as data was written. */
+      if (extended && offset > inode->length)
+        {
+          barrier ();
+          inode->data.length = offset;
+          inode->length = offset;
+          inode->mapped = mapped_sectors (offset);
+        }
+      else if (extended)
+        {
+          inode->mapped = mapped;
+          extended = false;
+        }
+      if (extended || remapped || inode->data.written != written)
+        inode_write_disk (inode);
+      lock_release (&inode->grow_lock);
+    }
   free (bounce);
   return bytes_written;
 }
 
+/* Writes INODE's cached data and on-disk inode back to disk,
+   returning once they are there. */
+void
+inode_flush (struct inode *inode)
+{
+  off_t mapped = mapped_sectors (inode_length (inode));
+  off_t index;
+
+
+  for (index = 0; index < mapped; index++)
+    {
+      disk_sector_t sector = index_to_sector (inode, index);
+      if (sector != 0)
+        cache_flush (sector);
+    }
+  if (inode->data.format == INODE_EXTENTS)
+    {
+      cache_flush (inode->sector);
+      return;
+    }
+  if (inode->data.sindirect != 0)
+    cache_flush (inode->data.sindirect);
+  for (index = DIRECT_BLOCK + BLOCK_PER_INDIRECT_BLOCK; index < mapped;
+       index += BLOCK_PER_INDIRECT_BLOCK)
+    {
+      off_t idx;
+      disk_sector_t sector = index_to_indirect (&inode->data, index, &idx);
+      if (sector != 0)
+        cache_flush (sector);
+    }
+  if (inode->data.dindirect != 0)
+    cache_flush (inode->data.dindirect);
+  cache_flush (inode->sector);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->grow_lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->grow_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -668,9 +1205,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->grow_lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->grow_lock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -685,6 +1224,15 @@ inode_is_dir (const struct inode *inode){
   return inode->is_dir;
 }
 
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
+}
+
+/* Locks and unlocks directory INODE's entries against concurrent
+   updates. */
 void inode_lock (const struct inode *inode){
   lock_acquire(&((struct inode *) inode)->lock);
 }
@@ -702,14 +1250,28 @@ bool add_parent (disk_sector_t parent, disk_sector_t child){
   struct inode *inode = inode_open(child);
   if (inode== NULL)
 	return false;
-  struct inode_disk *id = calloc (1, sizeof *id);
-  disk_read (filesys_disk, child, id);
-
+  lock_acquire (&inode->grow_lock);
   inode->parent = parent;
-  id->parent = parent;
-  disk_write (filesys_disk, child, id);
+  inode->data.parent = parent;
+  inode_write_disk (inode);
+  lock_release (&inode->grow_lock);
 
-  free(id);
   inode_close (inode);
   return true;
 }
+
+/* Returns a hash of inode E's sector. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Orders inodes A and B by sector. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
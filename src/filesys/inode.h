@@ -3,11 +3,11 @@
 
 #include <stdbool.h>
 #include "filesys/off_t.h"
-#include "devices/disk.h"
+#include "devices/block.h"
 #include "threads/synch.h"
 
 struct bitmap;
-struct lock i_lock;
+extern bool inode_use_extents;
 
 void inode_init (void);
 bool inode_create (disk_sector_t, off_t, bool);
@@ -18,12 +18,15 @@ int inode_get_open_cnt (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
+void inode_read_ahead (struct inode *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+void inode_flush (struct inode *);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
 
 bool inode_is_dir (const struct inode *);
+bool inode_is_removed (const struct inode *);
 void inode_lock (const struct inode *inode);
 void inode_unlock (const struct inode *inode);
 
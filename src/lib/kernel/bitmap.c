@@ -28,6 +28,7 @@ struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    size_t hint[2];     /* hint[V]: no bit below it is set to V. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +61,56 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Atomically sets *P to NEW if it is OLD, and returns true if it
+   did.  The hints are updated this way because bits may be freed
+   without a lock held, e.g. by palloc_free_page(). */
+static inline bool
+hint_swap (size_t *p, size_t old, size_t new)
+{
+  size_t prev;
+  asm volatile ("cmpxchgl %2, %1"
+                : "=a" (prev), "+m" (*p) : "r" (new), "0" (old) : "cc");
+  return prev == old;
+}
+
+/* Notes that the bits from START on may now include some set to
+   VALUE. */
+static inline void
+lower_hint (struct bitmap *b, size_t start, bool value)
+{
+  size_t hint;
+  while (start < (hint = b->hint[value])
+         && !hint_swap (&b->hint[value], hint, start))
+    continue;
+}
+
+/* Returns the index of the first bit at or after START in B that
+   is set to VALUE, or B's bit count if there is none.  Whole
+   elements without such a bit are skipped in one step. */
+static size_t
+find_next (const struct bitmap *b, size_t start, bool value)
+{
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t last = elem_cnt (b->bit_cnt);
+  size_t idx = elem_idx (start);
+  elem_type word;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  /* WORD has a 1 for each bit set to VALUE, ignoring those before
+     START. */
+  word = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+  while (word == 0)
+    {
+      if (++idx >= last)
+        return b->bit_cnt;
+      word = b->bits[idx] ^ flip;
+    }
+  start = idx * ELEM_BITS + __builtin_ctzl (word);
+  return start < b->bit_cnt ? start : b->bit_cnt;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -83,6 +134,7 @@ bitmap_create (size_t bit_cnt)
     {
       b->bit_cnt = bit_cnt;
       b->bits = malloc (byte_cnt (bit_cnt));
+      b->hint[false] = b->hint[true] = 0;
       if (b->bits != NULL || bit_cnt == 0)
         {
           bitmap_set_all (b, false);
@@ -105,6 +157,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->hint[false] = b->hint[true] = 0;
   bitmap_set_all (b, false);
   return b;
 }
@@ -164,6 +217,7 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the OR instruction in [IA32-v2b]. */
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  lower_hint (b, bit_idx, true);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -177,6 +231,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the AND instruction in [IA32-v2a]. */
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  lower_hint (b, bit_idx, false);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -192,6 +247,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  lower_hint (b, bit_idx, (b->bits[idx] & mask) != 0);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -214,18 +270,29 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.  Whole
+   elements are set at a time. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  size_t end = start + cnt;
   size_t i;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (i = start; i < end && i % ELEM_BITS != 0; i++)
+    bitmap_set (b, i, value);
+  for (; i + ELEM_BITS <= end; i += ELEM_BITS)
+    b->bits[elem_idx (i)] = value ? (elem_type) -1 : 0;
+  for (; i < end; i++)
+    bitmap_set (b, i, value);
+
+  if (cnt > 0)
+    lower_hint (b, start, value);
+  if (start == 0 && cnt == b->bit_cnt)
+    b->hint[!value] = b->bit_cnt;
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -251,16 +318,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return cnt > 0 && find_next (b, start, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -292,22 +354,36 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+   The search goes run by run: it finds the next bit set to VALUE,
+   then the next bit after it that is not, and moves past the run
+   between them if it is too short.  It starts no lower than B's
+   hint for VALUE. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+  if (cnt == 0)
+    return start;
+
+  if (start < b->hint[value])
+    start = b->hint[value];
+  for (;;)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t end;
+
+      start = find_next (b, start, value);
+      if (start > b->bit_cnt - cnt)
+        return BITMAP_ERROR;
+      end = find_next (b, start, !value);
+      if (end - start >= cnt)
+        return start;
+      start = end;
     }
-  return BITMAP_ERROR;
 }
 
 /* Finds the first group of CNT consecutive bits in B at or after
@@ -320,7 +396,25 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
 {
-  size_t idx = bitmap_scan (b, start, cnt, value);
+  size_t idx, hint;
+
+  /* Move the hint up to the first bit set to VALUE, so that later
+     scans skip the prefix this one walks past.  A bit set to VALUE
+     in that prefix after find_next() passed it, by a free that
+     found the hint still below it, would be skipped for good, so
+     look again once the hint has moved and lower it back. */
+  hint = b->hint[value];
+  if (start <= hint)
+    {
+      size_t next = find_next (b, hint, value);
+      if (next != hint && hint_swap (&b->hint[value], hint, next))
+        {
+          size_t missed = find_next (b, hint, value);
+          if (missed < next)
+            lower_hint (b, missed, value);
+        }
+    }
+  idx = bitmap_scan (b, start, cnt, value);
   if (idx != BITMAP_ERROR) 
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
@@ -347,6 +441,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      b->hint[false] = b->hint[true] = 0;
     }
   return success;
 }
@@ -359,6 +454,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the part of B stored in bytes OFS through OFS + SIZE - 1
+   of its file to the same place in FILE, clipped to the end of
+   B.  Return true if successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  if (ofs >= file_size)
+    return true;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (size_t) file_write_at (file, (uint8_t *) b->bits + ofs, size, ofs)
+         == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -0,0 +1,77 @@
+/* Creates enough files in one directory to convert it to the
+   hashed layout and split its buckets until there are no more
+   to split, then reads the directory back, opens every file by
+   name, and removes them all. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Past the 3/4 load of the largest hashed directory, 112
+   buckets of 25 entries each. */
+#define FILE_CNT 2200
+
+static bool seen[FILE_CNT];
+
+void
+test_main (void) 
+{
+  char name[READDIR_MAX_LEN + 1];
+  char file_name[128];
+  size_t cnt;
+  int fd, i;
+
+  CHECK (mkdir ("/x"), "mkdir \"/x\"");
+
+  msg ("creating %d files in \"/x\"", FILE_CNT);
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+    }
+  quiet = false;
+
+  msg ("reading \"/x\"");
+  CHECK ((fd = open ("/x")) > 1, "open \"/x\"");
+  for (cnt = 0; readdir (fd, name); cnt++)
+    {
+      if (memcmp (name, "file", 4))
+        fail ("readdir returned unexpected \"%s\"", name);
+      i = atoi (name + 4);
+      if (i < 0 || i >= FILE_CNT || seen[i])
+        fail ("readdir returned \"%s\" out of range or twice", name);
+      seen[i] = true;
+    }
+  if (cnt != FILE_CNT)
+    fail ("readdir returned %zu files, expected %d", cnt, FILE_CNT);
+  close (fd);
+
+  msg ("opening every file in \"/x\"");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+      close (fd);
+    }
+  quiet = false;
+
+  msg ("removing every file in \"/x\"");
+  quiet = true;
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "/x/file%d", i);
+      CHECK (remove (file_name), "remove \"%s\"", file_name);
+      CHECK (open (file_name) == -1, "open \"%s\" (must fail)", file_name);
+    }
+  quiet = false;
+
+  CHECK ((fd = open ("/x")) > 1, "open \"/x\"");
+  CHECK (!readdir (fd, name), "verify \"/x\" is empty");
+  msg ("close \"/x\"");
+  close (fd);
+}
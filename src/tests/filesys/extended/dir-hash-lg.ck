@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hash-lg) begin
+(dir-hash-lg) mkdir "/x"
+(dir-hash-lg) creating 2200 files in "/x"
+(dir-hash-lg) reading "/x"
+(dir-hash-lg) open "/x"
+(dir-hash-lg) opening every file in "/x"
+(dir-hash-lg) removing every file in "/x"
+(dir-hash-lg) open "/x"
+(dir-hash-lg) verify "/x" is empty
+(dir-hash-lg) close "/x"
+(dir-hash-lg) end
+EOF
+pass;
@@ -0,0 +1,35 @@
+/* Writes a file and syncs it, then syncs a directory, which
+   also succeeds, and a file descriptor that was never opened,
+   which must fail. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5678];
+
+void
+test_main (void) 
+{
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("testme", 0), "create \"testme\"");
+  CHECK ((fd = open ("testme")) > 1, "open \"testme\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf, "write \"testme\"");
+  CHECK (fsync (fd), "fsync \"testme\"");
+  msg ("close \"testme\"");
+  close (fd);
+  check_file ("testme", buf, sizeof buf);
+
+  CHECK (mkdir ("xyzzy"), "mkdir \"xyzzy\"");
+  CHECK ((fd = open ("xyzzy")) > 1, "open \"xyzzy\"");
+  CHECK (fsync (fd), "fsync \"xyzzy\"");
+  msg ("close \"xyzzy\"");
+  close (fd);
+
+  CHECK (!fsync (0x20101234), "fsync bad fd (must return false)");
+}
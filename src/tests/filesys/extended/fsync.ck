@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync) begin
+(fsync) create "testme"
+(fsync) open "testme"
+(fsync) write "testme"
+(fsync) fsync "testme"
+(fsync) close "testme"
+(fsync) open "testme" for verification
+(fsync) verified contents of "testme"
+(fsync) close "testme"
+(fsync) mkdir "xyzzy"
+(fsync) open "xyzzy"
+(fsync) fsync "xyzzy"
+(fsync) close "xyzzy"
+(fsync) fsync bad fd (must return false)
+(fsync) end
+EOF
+pass;
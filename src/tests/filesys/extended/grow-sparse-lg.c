@@ -0,0 +1,56 @@
+/* Writes a block of data far past the end of an empty file,
+   further out than the whole file system disk reaches, which only
+   works if the hole before it takes up no sectors.  Then checks
+   that the hole reads back as zeros and removes the file. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Past the end of the 2 MB file system disk. */
+#define DATA_OFS 5000000
+
+static char buf[512];
+static char zeros[512];
+
+void
+test_main (void) 
+{
+  static const int hole_ofs[] = {0, 61440, 100000, 1048576, DATA_OFS - 512};
+  const char *file_name = "testfile";
+  char block[512];
+  size_t i;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, DATA_OFS);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\" past the end of the disk", file_name);
+  CHECK (filesize (fd) == DATA_OFS + sizeof buf,
+         "filesize \"%s\"", file_name);
+
+  msg ("read hole in \"%s\"", file_name);
+  for (i = 0; i < sizeof hole_ofs / sizeof *hole_ofs; i++)
+    {
+      seek (fd, hole_ofs[i]);
+      if (read (fd, block, sizeof block) != sizeof block)
+        fail ("read of hole at offset %d failed", hole_ofs[i]);
+      compare_bytes (block, zeros, sizeof block, hole_ofs[i], file_name);
+    }
+
+  msg ("read data in \"%s\"", file_name);
+  seek (fd, DATA_OFS);
+  CHECK (read (fd, block, sizeof block) == sizeof block,
+         "read \"%s\"", file_name);
+  compare_bytes (block, buf, sizeof block, DATA_OFS, file_name);
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-sparse-lg) begin
+(grow-sparse-lg) create "testfile"
+(grow-sparse-lg) open "testfile"
+(grow-sparse-lg) seek "testfile"
+(grow-sparse-lg) write "testfile" past the end of the disk
+(grow-sparse-lg) filesize "testfile"
+(grow-sparse-lg) read hole in "testfile"
+(grow-sparse-lg) read data in "testfile"
+(grow-sparse-lg) read "testfile"
+(grow-sparse-lg) close "testfile"
+(grow-sparse-lg) remove "testfile"
+(grow-sparse-lg) end
+EOF
+pass;
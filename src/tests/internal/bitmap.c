@@ -0,0 +1,136 @@
+/* Test program for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan() against a bit-at-a-time reference scan on
+   random bitmaps, then times allocation-style scans on a bitmap
+   the size of a large disk's free map.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/test.h"
+
+/* Largest bitmap to check against the reference scan. */
+#define MAX_BITS 300
+
+/* Size of the bitmap and number of scans to time. */
+#define BENCH_BITS (64 * 1024)
+#define BENCH_SCANS 2000
+
+static size_t reference_scan (const struct bitmap *, size_t start,
+                              size_t cnt, bool value);
+static void check_scan (void);
+static void bench_scan (void);
+
+/* Test the bitmap scan. */
+void
+test (void)
+{
+  check_scan ();
+  bench_scan ();
+}
+
+/* Applies random changes to random bitmaps, comparing every
+   scan with the reference. */
+static void
+check_scan (void)
+{
+  int iter;
+
+  printf ("checking bitmap_scan:");
+  for (iter = 0; iter < 2000; iter++)
+    {
+      size_t bit_cnt = random_ulong () % MAX_BITS + 1;
+      struct bitmap *b = bitmap_create (bit_cnt);
+      int op;
+
+      ASSERT (b != NULL);
+      for (op = 0; op < 50; op++)
+        {
+          size_t start = random_ulong () % bit_cnt;
+          size_t cnt = random_ulong () % (bit_cnt - start + 1);
+          bool value = random_ulong () % 2;
+
+          switch (random_ulong () % 3)
+            {
+            case 0:
+              bitmap_set_multiple (b, start, cnt, value);
+              break;
+            case 1:
+              bitmap_flip (b, start);
+              break;
+            default:
+              cnt = random_ulong () % 8 + 1;
+              start = random_ulong () % (bit_cnt + 1);
+              ASSERT (bitmap_scan (b, start, cnt, value)
+                      == reference_scan (b, start, cnt, value));
+              bitmap_scan_and_flip (b, start, cnt, value);
+              break;
+            }
+        }
+      bitmap_destroy (b);
+      if (iter % 200 == 0)
+        printf (" %d", iter);
+    }
+  printf (" done\n");
+}
+
+/* Fills a large bitmap the way a busy free map looks, mostly
+   allocated with scattered holes, then times allocating from it
+   and freeing back. */
+static void
+bench_scan (void)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  int64_t start;
+  size_t i;
+
+  ASSERT (b != NULL);
+  bitmap_set_all (b, true);
+  for (i = 0; i < BENCH_BITS / 64; i++)
+    bitmap_reset (b, random_ulong () % BENCH_BITS);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    {
+      size_t idx = bitmap_scan_and_flip (b, 0, 1, false);
+      if (idx == BITMAP_ERROR)
+        break;
+      bitmap_reset (b, random_ulong () % BENCH_BITS);
+    }
+  printf ("%d single-bit scans of %d bits: %lld ticks\n",
+          BENCH_SCANS, BENCH_BITS, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_SCANS; i++)
+    bitmap_scan (b, 0, 8, false);
+  printf ("%d 8-bit run scans of %d bits: %lld ticks\n",
+          BENCH_SCANS, BENCH_BITS, timer_elapsed (start));
+
+  bitmap_destroy (b);
+}
+
+/* Finds CNT consecutive bits set to VALUE in B at or after START
+   by testing one bit at a time. */
+static size_t
+reference_scan (const struct bitmap *b, size_t start, size_t cnt,
+                bool value)
+{
+  size_t i, j;
+
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
@@ -35,9 +35,13 @@
 #include "vm/swap.h"
 #endif
 #ifdef FILESYS
+#include "devices/block.h"
 #include "devices/disk.h"
+#include "devices/ramdisk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
 #endif
 
 //#include "vm/frame.h"
@@ -51,6 +55,13 @@ uint32_t *base_page_dir;
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
+
+/* -rd: Size of the RAM disk in sectors, 0 for none. */
+static disk_sector_t ramdisk_sectors;
+
+/* -filesys, -scratch: Names of block devices to use, overriding
+   the defaults. */
+static const char *block_device_names[BLOCK_ROLE_CNT];
 #endif
 
 /* -q: Power off after kernel tasks complete? */
@@ -65,6 +76,9 @@ static void run_actions (char **argv);
 static void usage (void);
 
 static void print_stats (void);
+#ifdef FILESYS
+static void locate_block_devices (void);
+#endif
 
 
 int main (void) NO_RETURN;
@@ -125,10 +139,13 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   disk_init ();
+  ramdisk_init (ramdisk_sectors);
+  locate_block_devices ();
   filesys_init (format_filesys);
 #endif
 #ifdef VM
   vm_swt_init ();
+  vm_pageout_init ();
 #endif
   printf ("Boot complete.\n");
   
@@ -262,6 +279,22 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef FILESYS
+      else if (!strcmp (name, "-cache"))
+        cache_max_sectors = atoi (value);
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents = true;
+      else if (!strcmp (name, "-rd"))
+        ramdisk_sectors = atoi (value);
+      else if (!strcmp (name, "-filesys"))
+        block_device_names[BLOCK_FILESYS] = value;
+      else if (!strcmp (name, "-scratch"))
+        block_device_names[BLOCK_SCRATCH] = value;
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-swap"))
+        vm_swap_devices = value;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -366,6 +399,16 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef FILESYS
+          "  -cache=SECTORS     Size the buffer cache to SECTORS sectors.\n"
+          "  -extents           Map new files with extents, not blocks.\n"
+          "  -rd=SECTORS        Create RAM disk rd0 of SECTORS sectors.\n"
+          "  -filesys=DEVICE    Use DEVICE, e.g. hd0:1 or rd0, for file system.\n"
+          "  -scratch=DEVICE    Use DEVICE for scratch.\n"
+#endif
+#ifdef VM
+          "  -swap=DEV[@PRI],... Swap to DEVs, striped across equal PRIs.\n"
 #endif
           );
   power_off ();
@@ -396,6 +439,38 @@ power_off (void)
   for (;;);
 }
 
+#ifdef FILESYS
+/* Gives each role the block device named for it on the command
+   line, or else the ATA disk Pintos usually puts there:
+        hd0:0 - boot loader, command line args, and kernel
+        hd0:1 - file system
+        hd1:0 - scratch
+        hd1:1 - swap
+   -swap may add more devices to swap to; see vm/swap.c. */
+static void
+locate_block_devices (void)
+{
+  static const char *defaults[BLOCK_ROLE_CNT] = {"hd0:1", "hd1:0", "hd1:1"};
+  enum block_role role;
+
+  for (role = 0; role < BLOCK_ROLE_CNT; role++)
+    {
+      const char *name = block_device_names[role];
+      struct block *b;
+
+      if (name == NULL)
+        name = defaults[role];
+      b = block_get_by_name (name);
+      if (b == NULL && block_device_names[role] != NULL)
+        PANIC ("%s: no such block device for %s",
+               name, block_role_name (role));
+      if (b != NULL)
+        printf ("%s: using %s\n", block_role_name (role), name);
+      block_set_role (role, b);
+    }
+}
+#endif
+
 /* Print statistics about Pintos execution. */
 static void
 print_stats (void) 
@@ -403,7 +478,7 @@ print_stats (void)
   timer_print_stats ();
   thread_print_stats ();
 #ifdef FILESYS
-  disk_print_stats ();
+  block_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
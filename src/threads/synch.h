@@ -44,6 +44,23 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Readers-writer lock.
+   Any number of readers, or a single writer, may hold it. */
+struct rwlock
+  {
+    struct lock lock;           /* Protects the fields below. */
+    struct condition changed;   /* Signaled when the lock may be free. */
+    int readers;                /* Number of readers holding the lock. */
+    int waiting_writers;        /* Writers blocked in rwlock_acquire_write. */
+    struct thread *writer;      /* Writer holding the lock, if any. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
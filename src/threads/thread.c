@@ -113,7 +113,6 @@ thread_init (void)
 
   lock_init (&tid_lock);
   list_init (&ready_list);
-  lock_init (&filesys_lock);
   list_init (&thread_list);
 
   //list_init (&block_list);
@@ -672,25 +671,6 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
-void acquire_filesys_lock (void){
-  /*
-  printf("[%d] tryin' acquire\n", thread_current ()-> tid);
-  struct list_elem *e;
-  struct thread *temp;
-  for (e=list_begin (&filesys_lock.semaphore.waiters);
-	  e!=list_end (&filesys_lock.semaphore.waiters);
-	  e=list_next(e))
-	printf("₩₩waiting.....[%d]\n", list_entry (e, struct thread, elem) -> tid);
-  */
-  lock_acquire (&filesys_lock);
-  //printf("ACQUIRED....[%d]\n", filesys_lock.holder->tid);
-}
-void release_filesys_lock (void){
-  //printf("tryin' release\n");
-  lock_release (&filesys_lock);
-  //printf("[%d] RELEASED\n", thread_current()-> tid);
-}
-
 struct thread *get_thread (tid_t tid){
   struct list_elem *e;
   struct thread *temp;
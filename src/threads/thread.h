@@ -149,7 +149,6 @@ struct file_desc
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
-struct lock filesys_lock;
 void thread_init (void);
 void thread_start (void);
 
@@ -181,7 +180,5 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-void acquire_filesys_lock (void);
-void release_filesys_lock (void);
 struct thread *get_thread (tid_t);
 #endif /* threads/thread.h */
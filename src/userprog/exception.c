@@ -225,12 +225,6 @@ page_fault (struct intr_frame *f)
           user ? "user" : "kernel");
   */
 	
-	if (lock_held_by_current_thread (&filesys_lock))
-		release_filesys_lock ();
-	
-	if (lock_held_by_current_thread (&cache_lock))
-	  lock_release (&cache_lock);
-  
 	exit_ (-1);
   }
 	/*
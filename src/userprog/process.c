@@ -117,9 +117,7 @@ start_process (void *f_name)
   if_.gs = if_.fs = if_.es = if_.ds = if_.ss = SEL_UDSEG;
   if_.cs = SEL_UCSEG;
   if_.eflags = FLAG_IF | FLAG_MBS;
-  acquire_filesys_lock ();
   success = load (file_name, &if_.eip, &if_.esp);
-  release_filesys_lock ();
   palloc_free_page (file_name);
   
   struct thread *parent = get_thread (thread_current ()->pa_tid);
@@ -236,13 +234,11 @@ process_exit (void)
   }
   */
   //printf("I want to die : [%d]\n", curr->tid);
-  acquire_filesys_lock ();
   if (thread_current ()->proc != NULL){
   file_allow_write (thread_current ()->proc);
   file_close (thread_current ()->proc);
   }
   file_close_all ();
-  release_filesys_lock ();
   child_close_all ();
 
   //printf("PAPA WAKEUP\n");
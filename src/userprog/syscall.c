@@ -12,6 +12,7 @@
 #include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/inode.h"
+#include "filesys/free-map.h"
 
 #define PHYS_TOP ((void *) 0x08048000)
 
@@ -22,7 +23,7 @@ bool low_fd_func (const struct list_elem *a,
 	
 	list_entry (b, struct file_desc, fd_elem)->fd;
 }
-static int (*syscall_case[20]) (struct intr_frame *f);
+static int (*syscall_case[21]) (struct intr_frame *f);
 
 static void syscall_handler (struct intr_frame *);
 static void valid_usrptr (const void *uaddr);
@@ -109,16 +110,12 @@ static int syscall_exec_ (struct intr_frame *f){
   strlcpy (f_name, file_name, strlen(file_name)+1);
   char *save_ptr;
   f_name = strtok_r (f_name, " ", &save_ptr);
-  acquire_filesys_lock ();
   struct file* ff = filesys_open (f_name);
-  release_filesys_lock ();
   if(ff==NULL){
 	f->eax = -1;
 	return 0;
   }
-  acquire_filesys_lock ();
   file_close (ff);
-  release_filesys_lock ();
   free(f_name);
   
   f->eax = process_execute(file_name);
@@ -141,12 +138,10 @@ static int syscall_create_ (struct intr_frame *f){
   char *file = * (char **) (f->esp+4);
   unsigned size = * (unsigned *) (f->esp+8);
   bool success = false;
-  acquire_filesys_lock ();
 
   success = filesys_create (file, size, false);
   f->eax = success;
 
-  release_filesys_lock ();
   return 0;
 } 
 static int syscall_remove_ (struct intr_frame *f){
@@ -155,11 +150,9 @@ static int syscall_remove_ (struct intr_frame *f){
   char *file = * (char **) (f->esp+4);
   bool success = false;
 
-  acquire_filesys_lock ();
 
   success = filesys_remove (file);
   f->eax = success;
-  release_filesys_lock ();
   
   return 0;
 } 
@@ -168,10 +161,8 @@ static int syscall_open_ (struct intr_frame *f){
   valid_multiple (f->esp, 1);
   valid_usrptr (* (uint32_t *) (f->esp+4));
   char *file_name = * (char **) (f->esp+4);
-  acquire_filesys_lock ();
   struct file *ff = filesys_open (file_name);
   
-  release_filesys_lock ();
   //printf("OPENING BY PID[%d]\n", thread_current ()->tid);
 
   
@@ -249,9 +240,7 @@ static int syscall_filesize_ (struct intr_frame *f){
 	f->eax = -1;
     return -1;
   }
-  acquire_filesys_lock ();
   f->eax = file_length (temp->file);
-  release_filesys_lock ();
   /*
   struct list_elem *e;
   struct file_desc *temp;
@@ -260,9 +249,7 @@ static int syscall_filesize_ (struct intr_frame *f){
 	  e=list_next(e)){
 	temp = list_entry (e, struct file_desc, fd_elem);
 	if (fd==temp->fd){
-	  acquire_filesys_lock ();
 	  f->eax = file_length (temp->file);
-	  release_filesys_lock ();
 	  return 0;
 	}
   }*/
@@ -286,7 +273,6 @@ static int syscall_read_ (struct intr_frame *f){
 	struct file_desc *temp = fd_find (fd);
 	if (temp == NULL || temp->file ==NULL){
 		f->eax = -1;
-		release_filesys_lock ();
 		return 0;
 	}
 
@@ -354,7 +340,6 @@ static int syscall_read_ (struct intr_frame *f){
   
   //printf("[%d]......TRYINg TO READ fd[%d]\n", thread_current ()->tid, fd);
   
-  acquire_filesys_lock ();
   if (fd==0){
 	//acquire_filesys_lock ();
 	int i = 0;
@@ -362,7 +347,6 @@ static int syscall_read_ (struct intr_frame *f){
 	  * (buffer + i) = input_getc();
 	  i++;
 	}
-	release_filesys_lock ();
 	f->eax= size;
 	//goto finish;
 	return 0;
@@ -394,7 +378,6 @@ static int syscall_read_ (struct intr_frame *f){
 	}
   }
 //can't be reached   
-  release_filesys_lock ();
   f->eax = -1;
   return -1;
   
@@ -418,7 +401,6 @@ finish:
 	  size_temp =0;
 	}
   }
-  release_filesys_lock ();
   return 0;
 }
 
@@ -494,12 +476,10 @@ static int syscall_write_ (struct intr_frame *f){
   //============//
   
   
-  acquire_filesys_lock ();
   if (fd==1){
 	//acquire_filesys_lock ();
 	putbuf(buffer ,size);
 	f->eax = (int) size;
-	release_filesys_lock ();
 	return 0;
   }else{
 	struct list_elem *e;
@@ -521,7 +501,6 @@ static int syscall_write_ (struct intr_frame *f){
 	  }
 	}
   }
-  release_filesys_lock ();
   return -1;
 
 finish_:
@@ -544,7 +523,6 @@ finish_:
   }
 
 
-  release_filesys_lock ();
   return 0;
 }
 
@@ -557,18 +535,14 @@ static int syscall_seek_ (struct intr_frame *f){
 	//f->eax = -1;
 	return 0;
   }
-  acquire_filesys_lock ();
   file_seek (temp->file, position);
-  release_filesys_lock ();
   /*struct list_elem *temp = fd_find(fd);
   if (e==NULL){
 	f->eax = -1;
 	return 0;
   }
   struct file_desc *temp = list_entry (e, struct file_desc, fd_elem);
-  acquire_filesys_lock ();
   f->eax = file_seek (temp->file, position);
-  release_filesys_lock ();
   */
   return 0;
 }
@@ -592,9 +566,7 @@ static int syscall_tell_ (struct intr_frame *f){
 	  e=list_next(e)){
 	temp = list_entry (e, struct file_desc, fd_elem);
 	if (fd == temp->fd){
-	  acquire_filesys_lock ();
 	  f->eax = file_tell (temp->file);
-	  release_filesys_lock ();
 	  return 0;
 	}
   }
@@ -616,11 +588,9 @@ static int syscall_close_ (struct intr_frame *f){
 	  e=list_next(e)){
 	temp = list_entry (e, struct file_desc, fd_elem);
 	if (temp->fd == fd){
-	  acquire_filesys_lock ();
 	  file_close (temp->file);
 	  if (temp->dir != NULL)
 		dir_close (temp->dir);
-	  release_filesys_lock ();
 	  list_remove(e);
 	  free(temp);
 	  return 0;
@@ -639,7 +609,6 @@ static int syscall_mmap_ (struct intr_frame *f){
 	f->eax = -1;
 	return 0;
   }
-  acquire_filesys_lock ();
 
   //struct file *file;
   struct file_desc *temp = fd_find (fd);
@@ -686,7 +655,6 @@ static int syscall_mmap_ (struct intr_frame *f){
   md->size = len;
 
   list_push_back (&t->mmf_list, &md->mmf_elem);
-  release_filesys_lock ();
   f->eax = mapid;
   //printf( " mmap with fd: %d, mapid: %d \n", fd, f->eax);
   return 0;	
@@ -696,13 +664,11 @@ static int syscall_mmap_ (struct intr_frame *f){
 
 failed:
   //PANIC("mmap failed");
-  release_filesys_lock ();
   f->eax = MAP_FAILED;
   return 0;
 }
 bool munmap_ (int mapid){
 
-  acquire_filesys_lock ();
   
   struct mmf_desc *md = mmf_find (mapid);
   if (md == NULL)
@@ -721,14 +687,12 @@ bool munmap_ (int mapid){
   file_close (md->file);
   free (md);
 
-  release_filesys_lock ();
   //f->eax = 1;
   return true;
 
 failing:
  
   //f->eax = 0; 
-  release_filesys_lock ();
   PANIC ("Oh... can't munmap_");
   return false;
 }
@@ -742,7 +706,6 @@ static int syscall_munmap_ (struct intr_frame *f){
 
   
   /*
-  acquire_filesys_lock ();
 
   struct mmf_desc *md = mmf_find (mapid);
   if (md == NULL)
@@ -758,14 +721,12 @@ static int syscall_munmap_ (struct intr_frame *f){
   list_remove (&md->mmf_elem);
   free (md);
 
-  release_filesys_lock ();
   f->eax = 1;
   return 0;
 
 failing:
  
   f->eax = 0; 
-  release_filesys_lock ();
   return 0;
   */
 }
@@ -776,9 +737,7 @@ static int syscall_chdir_ (struct intr_frame *f){
   //valid_usrptr (* (uint32_t *) (f->esp+8));
   //int fd = *(int *) (f->esp+4);
   char *buffer = * (char **) (f->esp+4);
-  acquire_filesys_lock ();
   bool ret = filesys_chdir (buffer);
-  release_filesys_lock ();
 
   f->eax = ret;
   return 0;
@@ -791,9 +750,7 @@ static int syscall_mkdir_ (struct intr_frame *f){
 //  int fd = *(int *) (f->esp+4);
   char *buffer = * (char **) (f->esp+4);
  
-  acquire_filesys_lock ();
   bool ret= filesys_create (buffer, 0, true);
-  release_filesys_lock ();
   f->eax = ret;
   return 0;
 }
@@ -847,6 +804,26 @@ static int syscall_inumber_ (struct intr_frame *f){
   return 0;
 }
 
+static int syscall_fsync_ (struct intr_frame *f){
+  valid_multiple (f->esp, 1);
+  int fd = *(int *) (f->esp+4);
+
+  struct file_desc *temp = fd_find (fd);
+  if (temp == NULL){
+	f->eax = false;
+	return 0;
+  }
+  /* Only the free map's own sectors and this file's blocks: a
+     pending delete keeps its sectors in use until free_map_commit(),
+     so other files' dirty blocks need not go out first. */
+  free_map_sync ();
+  inode_flush (file_get_inode (temp->file));
+  /* Then out of the disk's own write cache. */
+  block_flush (filesys_disk);
+  f->eax = true;
+  return 0;
+}
+
 
 
 void
@@ -877,6 +854,8 @@ syscall_init (void)
   syscall_case[SYS_READDIR] = &syscall_readdir_;
   syscall_case[SYS_ISDIR] = &syscall_isdir_;
   syscall_case[SYS_INUMBER] = &syscall_inumber_;
+  //syscall extensions 20
+  syscall_case[SYS_FSYNC] = &syscall_fsync_;
 
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
@@ -10,30 +10,124 @@
 #include "vm/page.h"
 #include "vm/swap.h"
 #include "vm/frame.h"
+#include "filesys/cache.h"
 //#include "tests/lib.h"
 
 static struct lock frt_evict_lock;
 
+/* The frame table, palloc_user_page_cnt() entries. */
+static struct frt_entry *frt_array;
+
+/* The clock hand: the frame in the ring that eviction looked at
+   last, or null to start from the front.  FRT_CNT frames are in
+   the ring. */
+static struct list_elem *frt_hand;
+static size_t frt_cnt;
+
+/* The pageout thread keeps free frames on hand, so that a fault
+   usually finds one without waiting on a victim's write-back.  It
+   wakes when fewer than frt_low user pages are free and evicts
+   until frt_high are. */
+static size_t frt_low, frt_high;
+static struct condition pageout_wanted;
+
+/* A victim is written back without frt_lock held, marked SAVING
+   meanwhile.  FRT_SAVING_CNT frames are; frame_saved is signaled
+   as each one is done and freed. */
+static size_t frt_saving_cnt;
+static struct condition frame_saved;
+
+static void vm_frame_link (struct frt_entry *);
+static void vm_frame_unlink (struct frt_entry *);
+static void vm_pageout (void *);
+
 void vm_frt_init (void){
+  size_t cnt = palloc_user_page_cnt ();
+  size_t i;
+
+  frt_array = malloc (cnt * sizeof *frt_array);
+  if (frt_array == NULL)
+	PANIC ("vm_frt_init: CAN'T MAKE frame table");
+  for (i = 0; i < cnt; i++)
+	frt_array[i].frame = NULL;
   list_init (&frt);
   lock_init (&frt_lock);
   lock_init (&frt_evict_lock);
+  cond_init (&pageout_wanted);
+  cond_init (&frame_saved);
+
+  frt_low = cnt / 64 + 4;
+  frt_high = 2 * frt_low;
   return;
 }
 
+/* Returns how many user pages the pageout thread keeps free for
+   faults.  The buffer cache does not grow into them. */
+size_t vm_frame_reserve (void){
+  return frt_low;
+}
 
-void *vm_frame_alloc (enum palloc_flags flags){
+/* Starts the pageout thread.  Swap must be ready. */
+void vm_pageout_init (void){
+  thread_create ("pageout", PRI_DEFAULT, vm_pageout, NULL);
+}
+
+static void vm_pageout (void *aux UNUSED){
   acquire_frt_lock ();
+  for (;;){
+	while (palloc_user_free_cnt () >= frt_low)
+	  cond_wait (&pageout_wanted, &frt_lock);
+
+	while (palloc_user_free_cnt () < frt_high){
+	  struct frt_entry *victim;
+	  size_t freed;
+
+	  /* Clean cache pages are cheapest to give back. */
+	  release_frt_lock ();
+	  freed = cache_shrink (1);
+	  acquire_frt_lock ();
+	  if (freed > 0)
+		continue;
+
+	  /* With every frame pinned or on its way out, wait for the
+		 next fault to ask again. */
+	  victim = vm_evict_SC ();
+	  if (victim == NULL){
+		cond_wait (&pageout_wanted, &frt_lock);
+		continue;
+	  }
+	  if (!vm_frame_save (victim))
+		PANIC ("can't save the victim");
+	}
+  }
+}
+
+
+/* Takes a free frame without frt_lock, which palloc and the cache
+   do not need, so that a fault that finds one never waits on an
+   eviction in progress.  Only linking the frame in, or evicting,
+   takes frt_lock. */
+void *vm_frame_alloc (enum palloc_flags flags){
   //void *page;
   void *frame = palloc_get_page (PAL_USER | flags);
-  if (frame == NULL){
+  /* The buffer cache draws on the user pool too; take a clean
+     page back from it before resorting to eviction. */
+  if (frame == NULL && cache_shrink (1) > 0)
+    frame = palloc_get_page (PAL_USER | flags);
+  acquire_frt_lock ();
+  while (frame == NULL){
 	//PANIC ("WE WHOULD EVICT!!!");
 	//printf("vm_frame_alloc: WE HAVE TO EVICT SOME FRAME\n");
 	struct frt_entry *victim  = vm_frame_evict ();
 	//ASSERT (temp != NULL);
-    ASSERT (victim != NULL);
     
-	if (!vm_frame_save (victim)){
+	/* Nothing to evict: wait for a frame on its way out. */
+	if (victim == NULL){
+	  if (frt_saving_cnt == 0)
+		PANIC ("every frame is pinned");
+	  cond_wait (&frame_saved, &frt_lock);
+	}
+	else if (!vm_frame_save (victim)){
 	  PANIC ("can't save the victim");
 	}
 
@@ -78,72 +172,78 @@ void *vm_frame_alloc (enum palloc_flags flags){
 	//================//
 
     */
+    /* Another thread may have taken the frame freed here. */
     frame = palloc_get_page (PAL_USER | flags);
-	if (frame == NULL)
-	  PANIC ("Eviction failed again");
   }
 
   //acquire_frt_lock ();
-  struct frt_entry *f;
-  f = malloc (sizeof (*f));
-  if (f == NULL){
-	PANIC ("vm_frame_alloc: CAN'T MAKE NEW frt_entry");
-	return NULL;
-  }
+  struct frt_entry *f = &frt_array[palloc_user_page_no (frame)];
+  /* Every path that frees a frame unlinks it first. */
+  ASSERT (f->frame == NULL);
   f->frame = frame;
+  f->reclaiming = false;
+  f->saving = false;
   f->tid = thread_current ()->tid;
+  f->pagedir = thread_current ()->pagedir;
+  f->spt = &thread_current ()->spt;
   f->in_use = true;
-  list_push_back (&frt, &f->frt_elem);
+  vm_frame_link (f);
+  if (palloc_user_free_cnt () < frt_low)
+	cond_signal (&pageout_wanted, &frt_lock);
   release_frt_lock ();
   return frame;
 }
 
+/* Evicts F, with frt_lock held.  The page is unmapped from its
+   owner first, and then frt_lock is released while it is written
+   back, with F marked SAVING.  The owner waits in
+   vm_frame_wait_saved() until it is done. */
 bool vm_frame_save (struct frt_entry *f){
-  struct thread *t = get_thread (f->tid);
-  struct spt_entry *spte = vm_get_spt_entry (&t->spt, f->upage);
+  struct spt_entry *spte = vm_get_spt_entry (f->spt, f->upage);
+  bool dirty, success = true;
   ASSERT (!f->in_use);
   ASSERT (!f->reclaiming);
+  ASSERT (!f->saving);
+
+  dirty = pagedir_is_dirty (f->pagedir, f->upage);
+  pagedir_clear_page (f->pagedir, f->upage);
+  f->saving = true;
+  frt_saving_cnt++;
+  release_frt_lock ();
+
   if (spte->status == ON_MMF){
-	if (pagedir_is_dirty (t->pagedir, spte->upage)){
-	  acquire_filesys_lock ();
+	if (dirty){
 	  vm_frame_save_file (spte);
-	  acquire_filesys_lock ();
 	}
-	
-	goto saved;
   }
-
-  if (!vm_frame_save_swap (f))
-	return false;
   else
-	goto saved;
+	success = vm_frame_save_swap (f, spte);
 
-saved:
+  acquire_frt_lock ();
+  f->saving = false;
+  frt_saving_cnt--;
   spte->is_in_disk = false;
   spte->kpage = NULL;
-  pagedir_clear_page (t->pagedir, f->upage);
   vm_frame_free_no_lock (f->frame);
-  return true;
+  cond_broadcast (&frame_saved, &frt_lock);
+  return success;
 }
 bool vm_frame_save_file (struct spt_entry *s){
-  file_seek (s->file.file, s->file.ofs);
-  file_write (s->file.file, s->upage, s->file.read_bytes);
+  return file_write_at (s->file.file, s->kpage, s->file.read_bytes, s->file.ofs)
+	== (off_t) s->file.read_bytes;
 }
 
-bool vm_frame_save_swap (struct frt_entry *f){
-  struct thread *t = get_thread (f->tid);
-  ASSERT (t != NULL);
+bool vm_frame_save_swap (struct frt_entry *f, struct spt_entry *spte){
   //ASSERT (pg_ofs(f->upage) == 0); 
   if (pg_ofs(f->upage) != 0)
 	PANIC ("WHY NOW?");
 
   int swap_index = vm_swap_out (f->frame);
-  
+  if (swap_index < 0)
+	return false;
 
-  if (!vm_set_swap (&t->spt, f->upage, swap_index)){
-	printf("owner: %d, trier: %d\n", f->tid, thread_current ()->tid);
-	PANIC ("vm_frame_save - vm_set_swap: NO SUCH spt");
-  }
+  spte->status = ON_SWAP;
+  spte->swap_index = swap_index;
 /*
   pagedir_clear_page (t->pagedir, f->upage);
   vm_frame_free_no_lock (f->frame);
@@ -157,67 +257,62 @@ struct frt_entry *vm_frame_evict (void){
  // lock_acquire (&frt_evict_lock);
 
   victim = vm_evict_SC ();
-  ASSERT (victim != NULL);
 
  // lock_release (&frt_evict_lock);
   return victim;
 }
 
+/* Second chance by the clock: the hand sweeps the ring from
+   where the last eviction left it, clearing accessed bits, and
+   stops at the first frame that has not been accessed since the
+   hand last passed.  Two turns of the ring always find one,
+   unless every frame is pinned or being written back. */
 struct frt_entry *vm_evict_SC (void){
-  struct list_elem *e;
-  bool second = false;
   struct frt_entry *f;
-  struct thread *t;
-  //struct thread *t = thread_current ();
+  size_t n;
+
   if (list_empty (&frt)){
 	printf("vm_evict_SC: frt empty\n");
   }
 
-SCAN:
-  for (e = list_begin (&frt);
-	  e != list_end (&frt);
-	  e = list_next (e)){
-	
-	f = list_entry (e, struct frt_entry, frt_elem);
+  for (n = 0; n < 2 * frt_cnt; n++){
+	frt_hand = (frt_hand == NULL || frt_hand == list_back (&frt))
+	  ? list_begin (&frt) : list_next (frt_hand);
+	f = list_entry (frt_hand, struct frt_entry, frt_elem);
 	if (f->in_use)
 	  continue;
-    if (f->reclaiming)
+    if (f->reclaiming || f->saving)
 	  continue;
-    /*	
-	if (pg_ofs (f->upage) != 0){
-	  printf("upage value: %x / owner: %d / accessed by : %d  \n", (f->upage), f->tid, thread_current ()->tid);
-	}
-	*/
 	ASSERT (pg_ofs (f->upage) == 0);
-	
 
-	//msg ("[%d] directory checked", f->tid);
-	//printf ("[%d] directory checked", f->tid);
-	
-	t = get_thread (f->tid);
-	
-	if (pagedir_is_accessed (t->pagedir, f->upage)){
-	  if (second)
-		printf("CAN'T be happend\n");
-	  pagedir_set_accessed (t->pagedir, f->upage, false);
-	}else{
-	  //list_remove (e);
+	if (pagedir_is_accessed (f->pagedir, f->upage))
+	  pagedir_set_accessed (f->pagedir, f->upage, false);
+	else
 	  return f;
-	  //break;
-	}
-	
-  }
-
-  if (!second){
-//	printf("FUCKYOU\n");
-	second = true;
-	goto SCAN;
-  }else{
-	return NULL;
   }
   return NULL;
 }
 
+/* Links F into the clock ring, just behind the hand so that the
+   hand reaches it last. */
+static void vm_frame_link (struct frt_entry *f){
+  if (frt_hand == NULL)
+	list_push_back (&frt, &f->frt_elem);
+  else
+	list_insert (frt_hand, &f->frt_elem);
+  frt_cnt++;
+}
+
+/* Unlinks F from the clock ring, stepping the hand back if it
+   points at F. */
+static void vm_frame_unlink (struct frt_entry *f){
+  if (frt_hand == &f->frt_elem)
+	frt_hand = list_prev (&f->frt_elem) != list_head (&frt)
+	  ? list_prev (&f->frt_elem) : NULL;
+  list_remove (&f->frt_elem);
+  frt_cnt--;
+}
+
 void vm_frame_set (void *kpage, void*upage){
   acquire_frt_lock ();
   struct frt_entry *f = get_frt_entry (kpage);
@@ -255,8 +350,8 @@ void vm_frame_free_no_lock (void *frame)
   }
   //Remove frt_entry from the frt
   //acquire_frt_lock ();
-  list_remove (&f->frt_elem);
-  free (f);
+  vm_frame_unlink (f);
+  f->frame = NULL;
   //Free the frame
   //printf("vm_frame_palloc?\n");
   palloc_free_page (frame);
@@ -275,8 +370,8 @@ void vm_frame_destroy (void *frame)
   }
   //Remove frt_entry from the frt
   //acquire_frt_lock ();
-  list_remove (&f->frt_elem);
-  free (f);
+  vm_frame_unlink (f);
+  f->frame = NULL;
   //Free the frame
   //printf("vm_frame_palloc?\n");
   //release_frt_lock ();
@@ -307,6 +402,33 @@ void vm_frame_reclaimed (void *frame){
   return;
 }
 
+/* Waits, with frt_lock held, until SPTE's page is not being
+   written back by an eviction.  The page is then out of memory,
+   or still in its frame if no eviction took it. */
+void vm_frame_wait_saved (struct spt_entry *spte){
+  struct frt_entry *f;
+
+  while (spte->kpage != NULL
+	  && (f = get_frt_entry (spte->kpage)) != NULL && f->saving)
+	cond_wait (&frame_saved, &frt_lock);
+}
+
+/* Waits, with frt_lock held, until no frame of the owner of SPT
+   is being written back.  No eviction starts on one until
+   frt_lock is released. */
+void vm_frame_wait_owner (struct hash *spt){
+  size_t cnt = palloc_user_page_cnt ();
+  size_t i;
+
+  for (i = 0; i < cnt; i++){
+	struct frt_entry *f = &frt_array[i];
+	if (f->frame != NULL && f->saving && f->spt == spt){
+	  cond_wait (&frame_saved, &frt_lock);
+	  i = -1;
+	}
+  }
+}
+
 void acquire_frt_lock (void){
   lock_acquire (&frt_lock);
 }
@@ -315,19 +437,11 @@ void release_frt_lock (void){
   lock_release (&frt_lock);
 }
 
+/* Returns the entry for FRAME, a page from the user pool, or a
+   null pointer if FRAME is not a user frame now. */
 struct frt_entry *get_frt_entry (void *frame){
-  struct list_elem *e;
-  struct frt_entry *temp;
+  struct frt_entry *f = &frt_array[palloc_user_page_no (frame)];
 
-  //acquire_frt_lock ();
-  for (e=list_begin (&frt); e!=list_end (&frt); e=list_next (e)){
-	temp = list_entry (e, struct frt_entry, frt_elem);
-	if (temp->frame == frame){
-	  //release_frt_lock ();
-	  return temp;
-	}
-  }
-  //release_frt_lock ();
-  return NULL;
+  return f->frame == frame ? f : NULL;
 }
 
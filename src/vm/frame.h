@@ -13,12 +13,21 @@
 #include "threads/pte.h"
 #include "userprog/pagedir.h"
 
+/* One entry per page of the user pool, indexed by the page's
+   number within the pool; FRAME is null while the page is not a
+   user frame.  Frames in use are linked into the frt ring, which
+   eviction sweeps.  PAGEDIR and SPT are the owner's, so eviction
+   reaches them without looking the owner up.  SAVING is set while
+   eviction writes the frame back, without frt_lock. */
 struct frt_entry {
   void *frame;
   void *upage;
   tid_t tid;
+  uint32_t *pagedir;
+  struct hash *spt;
   bool in_use;
   bool reclaiming;
+  bool saving;
   struct list_elem frt_elem;
 };
 
@@ -26,10 +35,12 @@ struct lock frt_lock;
 struct list frt;
 
 void vm_frt_init (void);
+void vm_pageout_init (void);
+size_t vm_frame_reserve (void);
 void *vm_frame_alloc (enum palloc_flags);
 
 bool vm_frame_save (struct frt_entry *);
-bool vm_frame_save_swap (struct frt_entry *);
+bool vm_frame_save_swap (struct frt_entry *, struct spt_entry *);
 bool vm_frame_save_file (struct spt_entry *);
 
 struct frt_entry *vm_frame_evict (void);
@@ -42,6 +53,8 @@ void vm_frame_destroy (void *);
 
 void vm_frame_reclaiming (void *);
 void vm_frame_reclaimed (void *);
+void vm_frame_wait_saved (struct spt_entry *);
+void vm_frame_wait_owner (struct hash *);
 void acquire_frt_lock (void);
 void release_frt_lock (void);
 struct frt_entry *get_frt_entry (void *);
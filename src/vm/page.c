@@ -19,11 +19,15 @@ bool vm_spt_init (void){
   return hash_init (&t->spt, spt_hash_func, spt_hash_less_func, NULL);
 }
 
+/* Frees H and unlinks its frames from the frame table, all under
+   frt_lock, so that eviction never meets a frame whose owner is
+   partly gone.  The frames themselves go with the page directory. */
 void vm_spt_destroy (struct hash *h){
-//  acquire_frt_lock ();
+  acquire_frt_lock ();
+  vm_frame_wait_owner (h);
   hash_destroy (h, vm_spt_free);
   //free (h);
-//  release_frt_lock ();
+  release_frt_lock ();
 }
 
 //bool hash_init ();
@@ -148,6 +152,11 @@ bool vm_put_spt_mmf (struct file *file, off_t ofs, uint8_t *upage, uint32_t read
   }
 }
 bool vm_spt_reclaim (struct hash *h, struct spt_entry *spte){
+  /* An eviction may still be writing the page back. */
+  acquire_frt_lock ();
+  vm_frame_wait_saved (spte);
+  release_frt_lock ();
+
   if (spte->status == ON_FILE){
 	if(!vm_spt_reclaim_file (h, spte)){
 	  PANIC ("Can't reclaim file");
@@ -188,7 +197,6 @@ bool vm_spt_reclaim_mmf (struct hash *h, struct spt_entry *spte){
   
   //acquire_filesys_lock ();
 
-  file_seek (spte->file.file, spte->file.ofs);
   void *kpage = vm_frame_alloc (PAL_USER);
 
   if (kpage == NULL){
@@ -196,8 +204,8 @@ bool vm_spt_reclaim_mmf (struct hash *h, struct spt_entry *spte){
   }
 
   vm_frame_reclaiming (kpage);
-  if (file_read (spte->file.file, kpage, spte->file.read_bytes) 
-	  != (int) spte->file.read_bytes){
+  if (file_read_at (spte->file.file, kpage, spte->file.read_bytes,
+	                spte->file.ofs) != (int) spte->file.read_bytes){
 	vm_frame_free (kpage);
 	return false;
   }
@@ -243,8 +251,6 @@ bool vm_spt_reclaim_file (struct hash *h, struct spt_entry *spte){
 
   //acquire_filesys_lock ();
 
-  file_seek (spte->file.file, spte->file.ofs);
-  
   uint8_t *kpage = vm_frame_alloc (PAL_USER);
   
   if (kpage == NULL){
@@ -253,7 +259,8 @@ bool vm_spt_reclaim_file (struct hash *h, struct spt_entry *spte){
 
   vm_frame_reclaiming (kpage);
   
-  if (file_read (spte->file.file, kpage, spte->file.read_bytes) != (int) spte->file.read_bytes){
+  if (file_read_at (spte->file.file, kpage, spte->file.read_bytes,
+	                spte->file.ofs) != (int) spte->file.read_bytes){
 	vm_frame_free (kpage);
 	return false;
   }
@@ -279,6 +286,7 @@ bool vm_del_spt_mmf (struct thread *t, void *upage){
   if (spte == NULL){
 	PANIC ("can't unmap - vm_del_spt_mmf");
   }
+  vm_frame_wait_saved (spte);
  
  
   if (spte->is_in_disk){
@@ -368,10 +376,10 @@ bool spt_hash_less_func (const struct hash_elem *a,
   return sa->upage > sb->upage;
 }
 
+/* Called with frt_lock held. */
 void vm_spt_free (struct hash_elem *e, void *aux UNUSED){
   struct spt_entry *spte;
   spte = hash_entry (e, struct spt_entry, spt_elem);
-  acquire_frt_lock ();
 
   if (spte->kpage != NULL){
 	//PANIC ("WHY ARE YOU STILL HERE!!!\n");
@@ -384,6 +392,5 @@ void vm_spt_free (struct hash_elem *e, void *aux UNUSED){
   }
 
   free (spte);
-  release_frt_lock ();
 }
 
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "lib/kernel/list.h"
 #include "lib/kernel/hash.h"
@@ -11,62 +12,161 @@
 #include "vm/page.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
-#include "devices/disk.h"
+#include "devices/block.h"
 #include "threads/vaddr.h"
 
 static const size_t SECTORS_PER_PAGE = PGSIZE / DISK_SECTOR_SIZE;
 
-struct disk *swap_disk;
-struct bitmap *swap_map;
+/* Swap may span several devices.  Each holds a range of swap
+   slots, one page each, numbered from BASE; a swap index names a
+   slot across all of them.  Slots go first to the devices of the
+   highest priority that have room, round robin among devices of
+   equal priority, so that consecutive swap-outs, and the
+   swap-ins of their pages, land on different disks and can
+   proceed on both IDE channels at once. */
+#define SWAP_DEVICES 8
+
+struct swap_device {
+  struct block *block;
+  int prio;
+  size_t base;                  /* Swap index of the first slot. */
+  struct bitmap *map;           /* Free slots are true. */
+};
+
+/* -swap: Devices to swap to, as DEVICE[@PRIORITY],... */
+char *vm_swap_devices;
+
+static struct swap_device swap_devs[SWAP_DEVICES];
+static size_t swap_dev_cnt;
+static size_t swap_slots;       /* Total slots on all devices. */
+static size_t swap_rotor;       /* Spreads slots among equals. */
+static struct lock swap_lock;   /* Guards the maps and the rotor. */
+
+static void vm_swap_add (struct block *, int prio);
+static struct swap_device *vm_swap_device (size_t swap_index);
 
 void vm_swt_init (void){
-  swap_disk = disk_get (1, 1);
+  lock_init (&swap_lock);
+
+  if (vm_swap_devices != NULL){
+	char *token, *save_ptr;
+
+	for (token = strtok_r (vm_swap_devices, ",", &save_ptr); token != NULL;
+		token = strtok_r (NULL, ",", &save_ptr)){
+	  char *prio = strchr (token, '@');
+	  struct block *b;
 
-  if (swap_disk == NULL){
+	  if (prio != NULL)
+		*prio++ = '\0';
+	  b = block_get_by_name (token);
+	  if (b == NULL)
+		PANIC ("%s: no such swap device", token);
+	  vm_swap_add (b, prio != NULL ? atoi (prio) : 0);
+	}
+  }else if (block_get_role (BLOCK_SWAP) != NULL){
+	/* Other disks may hold data of their own, so only -swap
+	   adds them. */
+	vm_swap_add (block_get_role (BLOCK_SWAP), 0);
+  }
+
+  if (swap_dev_cnt == 0){
 	PANIC ("NO SWAP DISK");
   }
-  
-  disk_sector_t swap_size = disk_size (swap_disk) / SECTORS_PER_PAGE;
+  return;
+}
+
+/* Adds B to the swap devices with priority PRIO, keeping them
+   sorted by descending priority. */
+static void vm_swap_add (struct block *b, int prio){
+  size_t slots = block_size (b) / SECTORS_PER_PAGE;
+  struct swap_device *d;
+  size_t i;
 
-  swap_map = bitmap_create ((size_t) swap_size);
-  if (swap_map == NULL)
+  if (swap_dev_cnt >= SWAP_DEVICES)
+	PANIC ("%s: too many swap devices", block_name (b));
+  for (i = 0; i < swap_dev_cnt; i++)
+	if (swap_devs[i].block == b)
+	  PANIC ("%s: swap device given twice", block_name (b));
+
+  for (i = swap_dev_cnt; i > 0 && swap_devs[i - 1].prio < prio; i--)
+	swap_devs[i] = swap_devs[i - 1];
+  d = &swap_devs[i];
+  d->block = b;
+  d->prio = prio;
+  d->base = swap_slots;
+  d->map = bitmap_create (slots);
+  if (d->map == NULL)
 	PANIC ("NO SWAP MAP");
+  bitmap_set_all (d->map, true);
 
-  bitmap_set_all (swap_map, true);
-  return;
+  swap_dev_cnt++;
+  swap_slots += slots;
+  printf ("swap: %s has %zu slots, priority %d\n",
+	  block_name (b), slots, prio);
+}
+
+/* Returns the device that holds slot SWAP_INDEX. */
+static struct swap_device *vm_swap_device (size_t swap_index){
+  size_t i;
+
+  for (i = 0; i < swap_dev_cnt; i++){
+	struct swap_device *d = &swap_devs[i];
+	if (swap_index >= d->base
+		&& swap_index - d->base < bitmap_size (d->map))
+	  return d;
+  }
+  PANIC ("bad swap index %zu", swap_index);
 }
+
 bool vm_swap_in (int swap_index, void *upage){
-  disk_sector_t start = (disk_sector_t) swap_index;
-  int i = 0;
-  for (i = 0; i < SECTORS_PER_PAGE; i++)
-	disk_read (swap_disk, start * SECTORS_PER_PAGE + i,
-		upage + i * DISK_SECTOR_SIZE);
+  struct swap_device *d = vm_swap_device (swap_index);
+  size_t slot = swap_index - d->base;
 
-  //Do some I/O Ops
+  block_read_multiple (d->block, slot * SECTORS_PER_PAGE, SECTORS_PER_PAGE,
+	  upage);
 
-  bitmap_flip (swap_map, start);
+  lock_acquire (&swap_lock);
+  bitmap_flip (d->map, slot);
+  lock_release (&swap_lock);
   return true;
 }
 
 int vm_swap_out (const void *upage){
-  size_t swap_index = bitmap_scan_and_flip (swap_map, 0, 1, true);
+  struct swap_device *d = NULL;
+  size_t slot = BITMAP_ERROR;
+  size_t i, j, k;
+
+  /* Try each priority level in turn, starting at the rotor
+     among the devices in it. */
+  lock_acquire (&swap_lock);
+  for (i = 0; i < swap_dev_cnt && slot == BITMAP_ERROR; i = j){
+	for (j = i; j < swap_dev_cnt && swap_devs[j].prio == swap_devs[i].prio;
+		j++)
+	  continue;
+	for (k = 0; k < j - i; k++){
+	  d = &swap_devs[i + (swap_rotor + k) % (j - i)];
+	  slot = bitmap_scan_and_flip (d->map, 0, 1, true);
+	  if (slot != BITMAP_ERROR){
+		swap_rotor += k + 1;
+		break;
+	  }
+	}
+  }
+  lock_release (&swap_lock);
 
-  if (swap_index == BITMAP_ERROR ) 
+  if (slot == BITMAP_ERROR)
     return -1;
 
-  int i ;
-  for (i = 0; i < SECTORS_PER_PAGE; i++)
-	disk_write (swap_disk, swap_index * SECTORS_PER_PAGE + i,
-		upage + DISK_SECTOR_SIZE * i);
+  block_write_multiple (d->block, slot * SECTORS_PER_PAGE,
+	  SECTORS_PER_PAGE, upage);
 
-  return (int) swap_index;
+  return (int) (d->base + slot);
 }
-/*	
-//bitmap_flip (swap_map, swap_index);
-  return swap_index;
-}
-*/
 
 void vm_swap_free (int swap_index){
-  bitmap_set (swap_map, (size_t) swap_index, true);
+  struct swap_device *d = vm_swap_device (swap_index);
+
+  lock_acquire (&swap_lock);
+  bitmap_set (d->map, swap_index - d->base, true);
+  lock_release (&swap_lock);
 }
@@ -13,6 +13,9 @@
 #include "threads/pte.h"
 #include "userprog/pagedir.h"
 
+/* -swap: Devices to swap to, as DEVICE[@PRIORITY],... */
+extern char *vm_swap_devices;
+
 void vm_swt_init (void);
 void vm_swap_free (int);
 